@@ -14,18 +14,61 @@
 typedef uint64_t ecs_id_t;
 typedef struct ecs_t ecs_t;
 
+// Where a world gets its memory. `realloc` is only used on blocks allocated with an alignment of at most
+// alignof(max_align_t), and both it and `free` are told the size the block has. If `release` is set, ecs_delete calls
+// it instead of freeing the world's blocks one by one. Only the thread that owns the world allocates: the thread pool
+// and the command buffers use malloc.
+typedef struct {
+    void       *(*alloc)    (void *ctx, size_t size, size_t align);
+    void       *(*realloc)  (void *ctx, void *ptr, size_t old_size, size_t size);
+    void        (*free)     (void *ctx, void *ptr, size_t size);
+    void        (*release)  (void *ctx);
+    void       *ctx;
+} ecs_allocator_t;
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Functions
 
 ecs_t      *ecs_create                      (int entity_count_hint);
+ecs_t      *ecs_create_with                 (int entity_count_hint, ecs_allocator_t const *allocator);
 void        ecs_delete                      (ecs_t *ecs);
 
+// An allocator that carves blocks of `block_size` bytes (0 for 1MB) front to back and only frees them all at once,
+// when the world it is given to is deleted. For worlds that are built up and thrown away, like one per match.
+// If it can't get memory for its own state, every field of the allocator is NULL and ecs_create_with returns NULL.
+ecs_allocator_t ecs_arena                   (size_t block_size);
+
+// Systems are called once per chunk of every matching archetype (see ECS_CHUNK_SIZE), with that chunk's columns and
+// entities. Components prefixed with `const` are only read by the system, which lets ecs_run_all overlap it with
+// other readers. Archetypes with a component prefixed with `!` never match, and one prefixed with `?` is optional:
+// ecs_field returns NULL for it where it is missing. `const` goes first, as in `const ?Velocity`.
 #define     ecs_register(ecs, fn, ...)      _ecs_register((ecs), (fn), #__VA_ARGS__)
 ecs_id_t   _ecs_register                    (ecs_t *ecs, void (*fn)(void *, ecs_id_t *, size_t), char const *components);
 
+// Like ecs_register, but `fn` handles the rows [begin, begin + count) of a chunk so ecs_run_parallel can split it.
+// `components` and `entities` always point at the start of the chunk.
+#define     ecs_register_parallel(ecs, fn, ...) _ecs_register_parallel((ecs), (fn), #__VA_ARGS__)
+ecs_id_t   _ecs_register_parallel           (ecs_t *ecs, void (*fn)(void *, ecs_id_t *, size_t, size_t), char const *components);
+
+// Registering a name again with a different size is an error and trips an assert
+#define     ecs_component(ecs, T)           _ecs_component((ecs), #T, sizeof (T))
+ecs_id_t   _ecs_component                   (ecs_t *ecs, char const *component_name, size_t component_stride);
+
+// Tags are components with a stride of 0. They change which archetype an entity is in, and so which systems see it,
+// but own no column: ecs_get and ecs_field return NULL for them. `T` is only a name and needn't be a type.
+#define     ecs_tag(ecs, T)                 _ecs_component((ecs), #T, 0)
+#define     ecs_add(ecs, entity_id, T)      ecs_set_id((ecs), (entity_id), ecs_tag((ecs), T), NULL)
+#define     ecs_has(ecs, entity_id, T)      _ecs_has((ecs), (entity_id), #T)
+int        _ecs_has                         (ecs_t *ecs, ecs_id_t entity_id, char const *component_name);
+int         ecs_has_id                      (ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id);
+
 ecs_id_t    ecs_spawn                       (ecs_t *ecs);
 void        ecs_despawn                     (ecs_t *ecs, ecs_id_t entity_id);
 
+// Spawns `count` entities straight into the archetype made of `component_ids`. `component_data[i]` points to `count`
+// contiguous values of `component_ids[i]` (SoA), or is NULL to zero them. `entities` and `component_data` may be NULL.
+void        ecs_spawn_n                     (ecs_t *ecs, size_t count, ecs_id_t *entities, size_t component_count, ecs_id_t const *component_ids, void const *const *component_data);
+
 #define     ecs_set(ecs, entity_id, T, ...) _ecs_set((ecs), (entity_id), #T, sizeof (T), &(T)__VA_ARGS__)
 #define     ecs_get(ecs, entity_id, T)      _ecs_get((ecs), (entity_id), #T)
 #define     ecs_rem(ecs, entity_id, T)      _ecs_rem((ecs), (entity_id), #T)
@@ -33,9 +76,160 @@ void       _ecs_set                         (ecs_t *ecs, ecs_id_t entity_id, cha
 void      *_ecs_get                         (ecs_t *ecs, ecs_id_t entity_id, char const *component_name);
 void       _ecs_rem                         (ecs_t *ecs, ecs_id_t entity_id, char const *component_name);
 
+// Same as above but take a handle returned by ecs_component, skipping the name hash
+void        ecs_set_id                      (ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id, void const *data);
+void       *ecs_get_id                      (ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id);
+void        ecs_rem_id                      (ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id);
+
+// Adds or removes several components with a single archetype transition. `data[i]` may be NULL to zero the component.
+void        ecs_set_many                    (ecs_t *ecs, ecs_id_t entity_id, size_t component_count, ecs_id_t const *component_ids, void const *const *data);
+void        ecs_rem_many                    (ecs_t *ecs, ecs_id_t entity_id, size_t component_count, ecs_id_t const *component_ids);
+
 void        ecs_run                         (ecs_t *ecs, ecs_id_t system_id);
+
+// Queues the system on the thread pool, `grain` rows per task (0 for a default), and returns without waiting.
+// Systems from ecs_register run as one task per archetype. Call ecs_join before touching the world again.
+// The pool is only there when ECS_THREADS is defined before including the implementation (it needs pthreads and C11
+// atomics). Otherwise the tasks run on the calling thread before ecs_run_parallel returns, and ecs_threads does nothing.
+void        ecs_run_parallel                (ecs_t *ecs, ecs_id_t system_id, size_t grain);
+void        ecs_join                        (ecs_t *ecs);
+void        ecs_threads                     (ecs_t *ecs, int thread_count); // 0 uses one thread per core
+
+// Runs every registered system once on the thread pool and waits for them. Systems whose accesses conflict (one writes
+// a component the other reads or writes) keep their registration order, the rest run at the same time.
+void        ecs_run_all                     (ecs_t *ecs);
+
+// Deferred spawn/despawn/set/rem that are safe to call from systems, including ones running on the thread pool. Each
+// thread records into its own buffer and the world is only changed by ecs_flush, which ecs_join and ecs_run_all call
+// once every system is done. ecs_cmd_spawn returns the id the entity will have. Until the flush that spawns it, the
+// id isn't alive: ecs_get, ecs_set, ecs_has and ecs_despawn ignore it like a despawned one, the ecs_cmd_ calls don't.
+ecs_id_t    ecs_cmd_spawn                   (ecs_t *ecs);
+void        ecs_cmd_despawn                 (ecs_t *ecs, ecs_id_t entity_id);
+#define     ecs_cmd_set(ecs, entity_id, T, ...) _ecs_cmd_set((ecs), (entity_id), #T, sizeof (T), &(T)__VA_ARGS__)
+#define     ecs_cmd_rem(ecs, entity_id, T)  _ecs_cmd_rem((ecs), (entity_id), #T)
+void       _ecs_cmd_set                     (ecs_t *ecs, ecs_id_t entity_id, char const *component_name, size_t component_stride, void const *data);
+void       _ecs_cmd_rem                     (ecs_t *ecs, ecs_id_t entity_id, char const *component_name);
+void        ecs_cmd_set_id                  (ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id, void const *data);
+void        ecs_cmd_rem_id                  (ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id);
+void        ecs_flush                       (ecs_t *ecs);
+
+// Every write is stamped with the world's tick, which starts at 1 and only moves on ecs_advance. Writes are ecs_set*,
+// spawning, moving rows between archetypes, and running a system on a chunk with a component it doesn't declare
+// `const`. Stores through ecs_get pointers aren't seen. Ticks are kept per chunk and column, so with ECS_CHUNK_SIZE
+// at 0 a write marks the whole archetype's column.
+#define     ECS_CHANGED                     1
+#define     ECS_ADDED                       2
+uint32_t    ecs_tick                        (ecs_t const *ecs);
+uint32_t    ecs_advance                     (ecs_t *ecs);
+
+// Like ecs_run, but skips the chunks where `component_id` wasn't changed (ECS_CHANGED) or added (ECS_ADDED) after `since`
+void        ecs_run_since                   (ecs_t *ecs, ecs_id_t system_id, ecs_id_t component_id, int filter, uint32_t since);
+
+// Hierarchies. An entity's depth is 0 without a parent and one more than its parent's otherwise, and entities are
+// stored by depth: ecs_run visits every archetype of depth 0 before any of depth 1 and so on, so a system can update
+// children from the values their parents got earlier in the same pass. ecs_run_parallel and ecs_run_all don't keep
+// that order. Setting a parent moves the entity's whole subtree to its new depth, one row copy per entity. ECS_NONE
+// as the parent detaches the entity, and an entity can't be given one of its own descendants. ecs_despawn and
+// ecs_cmd_despawn take the entity's descendants with it.
+#define     ECS_NONE                        ((ecs_id_t)-1)
+void        ecs_set_parent                  (ecs_t *ecs, ecs_id_t entity_id, ecs_id_t parent_id);
+ecs_id_t    ecs_parent                      (ecs_t const *ecs, ecs_id_t entity_id);        // ECS_NONE if there is none
+ecs_id_t    ecs_first_child                 (ecs_t const *ecs, ecs_id_t entity_id);
+ecs_id_t    ecs_next_sibling                (ecs_t const *ecs, ecs_id_t entity_id);
+uint32_t    ecs_depth                       (ecs_t const *ecs, ecs_id_t entity_id);
+
+// Frees the archetypes no entity is in anymore, and the edges leading to them, so systems stop visiting them. The
+// others give back the chunks (or, with ECS_CHUNK_SIZE 0, the capacity) their rows don't need, the maps are rebuilt
+// at the size they need and pooled column buffers go back to the allocator. Not while systems run. Returns the
+// number of archetypes freed.
+size_t      ecs_compact                     (ecs_t *ecs);
+
+// The same in slices, for a per-frame budget: looks at up to `budget` archetypes, starting where the last call
+// stopped, and does the world-wide part once it has gone through all of them
+size_t      ecs_compact_step                (ecs_t *ecs, size_t budget);
+
+// Writes every entity and component to `path` as one contiguous block per column, and reads it back into a new world.
+// Systems aren't saved, register them again after loading. ecs_save returns 0 on success, ecs_load NULL on failure.
+// With ECS_LOAD_MMAP (and ECS_CHUNK_SIZE 0) the columns point straight into the file's image instead of being copied.
+// The image is a private mapping of the file when ECS_MMAP is defined before including the implementation (POSIX), so
+// nothing is read until it is touched, and otherwise one buffer the whole file is read into.
+#define     ECS_LOAD_MMAP                   1
+int         ecs_save                        (ecs_t const *ecs, char const *path);
+ecs_t      *ecs_load                        (char const *path, int flags);
+
+// Statistics. The counters marked below are only kept when ECS_STATS is defined before including the implementation,
+// otherwise they read 0 and cost nothing. The rest is computed when asked for.
+typedef struct {
+    size_t archetypes;
+    size_t entities;
+    size_t column_bytes;    // Allocated for every archetype's chunks
+    size_t transfers;       // ECS_STATS: rows moved between archetypes
+    size_t map_lookups;     // ECS_STATS: over every map of the world
+    size_t map_probes;      // ECS_STATS: home slots plus groups of slots looked at by those lookups
+    size_t map_resizes;     // ECS_STATS
+} ecs_stats_t;
+
+typedef struct {
+    uint64_t id;            // Hash of the component set, not necessarily unique
+    size_t rows;
+    size_t capacity;        // Rows allocated
+    size_t columns;
+    size_t chunks;
+    size_t bytes;
+} ecs_archetype_stats_t;
+
+typedef struct {
+    ecs_id_t component_id;
+    size_t stride;
+    size_t bytes;
+} ecs_column_stats_t;
+
+typedef struct {
+    uint64_t ns;            // ECS_STATS: time spent running the system, summed over threads
+    size_t entities;        // ECS_STATS: rows visited
+    size_t runs;            // ECS_STATS
+} ecs_system_stats_t;
+
+ecs_stats_t ecs_stats                       (ecs_t const *ecs);
+// Fill up to `cap` entries and return how many there are in total
+size_t      ecs_stats_archetypes            (ecs_t const *ecs, ecs_archetype_stats_t *stats, size_t cap);
+// `archetype_index` is a position in what ecs_stats_archetypes fills, since ids can collide
+size_t      ecs_stats_columns               (ecs_t const *ecs, size_t archetype_index, ecs_column_stats_t *stats, size_t cap);
+ecs_system_stats_t ecs_stats_system         (ecs_t const *ecs, ecs_id_t system_id);
+void        ecs_stats_reset                 (ecs_t *ecs);
+
+// Writes a Chrome trace (chrome://tracing, Perfetto) to `path`: with ECS_STATS, one slice per system run or parallel
+// task on the thread that ran it, and on each ecs_trace_frame, the stats above as counters (per frame for the ECS_STATS
+// ones). Returns 0 on success.
+int         ecs_trace_begin                 (ecs_t *ecs, char const *path);
+void        ecs_trace_frame                 (ecs_t *ecs);
+void        ecs_trace_end                   (ecs_t *ecs);
+
 #define     ecs_field(components, T)        _ecs_field((components), #T)
 void      *_ecs_field                       (void const *components, char const *component_name);
+void       *ecs_field_id                    (void const *components, ecs_id_t component_id);
+
+// Every column starts on an ECS_ALIGN byte boundary, and the bytes after a chunk's last row up to the next boundary
+// belong to the column too. A system registered with ecs_register can therefore run its kernels over whole
+// ECS_ALIGN blocks, ecs_padded(count, T) elements, with aligned loads and stores and no scalar tail. Stores past
+// `count` only land in rows nobody uses. Range systems share a chunk between tasks and can't do this.
+#define     ECS_ALIGN                       64
+#define     ecs_padded(count, T)            (((count) * sizeof (T) + ECS_ALIGN - 1) / ECS_ALIGN * ECS_ALIGN / sizeof (T))
+
+// Like ecs_field and ecs_field_id, typed and, with GCC or Clang, with the alignment known to the compiler
+#if defined(__GNUC__)
+#define    _ecs_assume_aligned(ptr)                             __builtin_assume_aligned((ptr), ECS_ALIGN)
+#else
+#define    _ecs_assume_aligned(ptr)                             ((void *)(ptr))
+#endif
+#define     ecs_field_aligned(components, T)                    ((T *)_ecs_assume_aligned(_ecs_field((components), #T)))
+#define     ecs_field_id_aligned(components, component_id, T)   ((T *)_ecs_assume_aligned(ecs_field_id((components), (component_id))))
+
+// Bulk operations over float columns, as handed to an ecs_register system (a column of `count` vec3s is 3 * count
+// floats). They work in whole ECS_ALIGN blocks, see above, so `dst` and `src` must be column starts.
+void        ecs_fill_f32                    (float *dst, float value, size_t count);
+void        ecs_copy_f32                    (float *dst, float const *src, size_t count);
+void        ecs_axpy_f32                    (float *dst, float const *src, float scale, size_t count); // dst += scale * src
 
 ///////////////////////////////////////////////////////////////////////////////
 ///                                                                         ///
@@ -45,43 +239,315 @@ void      *_ecs_field                       (void const *components, char const
 
 #if defined(ECS_IMPL)
 
+#include <assert.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#if defined(ECS_THREADS)
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#endif
+#if defined(ECS_MMAP)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Define as a size in bytes (e.g. 16384) to store every archetype in fixed-size chunks. Chunks are added as an
+// archetype grows without moving the rows already stored, and systems are handed one chunk at a time.
+// When 0, each archetype keeps all its rows in a single chunk that is reallocated as it grows.
+#ifndef ECS_CHUNK_SIZE
+#define ECS_CHUNK_SIZE 0
+#endif
+
+// Define ECS_STATS to keep the counters behind ecs_stats and the system timings
+#if defined(ECS_STATS)
+#define _ecs_stat(...) __VA_ARGS__
+#else
+#define _ecs_stat(...)
+#endif
+
+// Define ECS_THREADS for the thread pool, see ecs_run_parallel, and ECS_MMAP to map files in ecs_load. Without them the
+// implementation only needs C99 and libc.
+#if defined(ECS_THREADS)
+typedef atomic_size_t               _ecs_atomic_size_t;
+typedef atomic_uint_fast64_t        _ecs_atomic_u64_t;
+typedef pthread_mutex_t             _ecs_mutex_t;
+#define _ecs_atomic_init(p, v)      atomic_init((p), (v))
+#define _ecs_atomic_load(p)         atomic_load(p)
+#define _ecs_atomic_store(p, v)     atomic_store((p), (v))
+#define _ecs_atomic_add(p, v)       atomic_fetch_add((p), (v))
+#define _ecs_atomic_sub(p, v)       atomic_fetch_sub((p), (v))
+#define _ecs_atomic_exchange(p, v)  atomic_exchange((p), (v))
+#define _ecs_atomic_count(p, v)     atomic_fetch_add_explicit((p), (v), memory_order_relaxed)
+#define _ecs_atomic_peek(p)         atomic_load_explicit((p), memory_order_relaxed)
+#define _ecs_mutex_init(m)          pthread_mutex_init((m), NULL)
+#define _ecs_mutex_destroy(m)       pthread_mutex_destroy(m)
+#define _ecs_mutex_lock(m)          pthread_mutex_lock(m)
+#define _ecs_mutex_unlock(m)        pthread_mutex_unlock(m)
+#else
+// Only the calling thread ever touches the world, so plain values do. The fetch ones still return the old value.
+typedef size_t                      _ecs_atomic_size_t;
+typedef uint64_t                    _ecs_atomic_u64_t;
+typedef int                         _ecs_mutex_t;
+#define _ecs_atomic_init(p, v)      (void)(*(p) = (v))
+#define _ecs_atomic_load(p)         (*(p))
+#define _ecs_atomic_store(p, v)     (void)(*(p) = (v))
+#define _ecs_atomic_add(p, v)       ((*(p) += (v)) - (v))
+#define _ecs_atomic_sub(p, v)       ((*(p) -= (v)) + (v))
+#define _ecs_atomic_exchange(p, v)  _ecs_exchange((p), (v))
+#define _ecs_atomic_count(p, v)     (void)(*(p) += (v))
+#define _ecs_atomic_peek(p)         (*(p))
+#define _ecs_mutex_init(m)          (void)(*(m) = 0)
+#define _ecs_mutex_destroy(m)       (void)(m)
+#define _ecs_mutex_lock(m)          (void)(m)
+#define _ecs_mutex_unlock(m)        (void)(m)
+
+static size_t _ecs_exchange(size_t *p, size_t v) {
+    size_t old = *p;
+    *p = v;
+    return old;
+}
+#endif
+
+// Bit scans, never given 0. GCC and Clang have them built in.
+#if defined(__GNUC__)
+#define _ecs_ctz(x)                 __builtin_ctz(x)
+#define _ecs_clzll(x)               __builtin_clzll(x)
+#else
+static int _ecs_ctz(uint32_t x) {
+    int n = 0;
+    for (; !(x & 1); x >>= 1) n++;
+    return n;
+}
+
+static int _ecs_clzll(uint64_t x) {
+    int n = 0;
+    for (; !(x >> 63); x <<= 1) n++;
+    return n;
+}
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Types
 
+typedef struct {
+    char *data;
+    size_t cap;
+    size_t len;
+    size_t stride;
+    ecs_allocator_t const *allocator;
+} _ecs_arr_t;
+
 typedef struct {
     uint64_t key;
-    uint8_t dist;
+    size_t index;       // Into `keys` and `values`
 } _ecs_map_slot_t;
 
+// ECS_STATS counters of one world's maps
 typedef struct {
-    char *data;
-    size_t cap;
+    _ecs_atomic_size_t lookups;
+    _ecs_atomic_size_t probes;
+    _ecs_atomic_size_t resizes;
+} _ecs_map_stats_t;
+
+// Swiss table. Probing reads one control byte per slot, and slots only point at the packed entries, so growing never
+// copies values around
+typedef struct {
+    uint8_t *ctrl;      // Per slot: 7 bits of the key's hash, or _ecs_map_empty/_ecs_map_deleted. The first group is
+                        // repeated past the end so a group can be loaded starting at any slot
+    _ecs_map_slot_t *slots;
+    uint64_t *keys;     // Each entry's key again, to find its slot when _ecs_map_rem moves it
+    char *values;       // `stride` bytes per entry
+    size_t stride;
     size_t len;
+    size_t cap;         // Slots, a power of two
+    size_t entry_cap;   // Room in `keys` and `values`
+    size_t deleted;     // Slots left behind by _ecs_map_rem
+    ecs_allocator_t const *allocator;
+    _ecs_map_stats_t *stats;    // The owning world's, NULL for maps that only live through one call
+} _ecs_map_t;
+
+typedef struct {
+    ecs_id_t id;
     size_t stride;
-} _ecs_arr_t, _ecs_map_t;
+    size_t offset;      // Where the column starts inside a chunk
+} _ecs_column_t;
 
+typedef struct _ecs_archetype_t _ecs_archetype_t;
+
+// What systems get as `components`
 typedef struct {
-    _ecs_map_t edges;
-    _ecs_map_t components;
+    _ecs_archetype_t *archetype;
+    char *data;
+    uint32_t *changed;  // Last tick any row of each column (in `layout` order) was written
+    uint32_t *added;    // Last tick a row got each column
+    int mapped;         // `data` points into the file given to ecs_load and isn't ours to free
+} _ecs_chunk_t;
+
+struct _ecs_archetype_t {
+    _ecs_arr_t components;  // Sorted component ids, what actually identifies the archetype
+    _ecs_arr_t signature;   // uint64_t words, with the bit of each of `components` set (see _ecs_component_bit)
+    _ecs_map_t columns;     // Component ids, with no value: an id's entry index is its index into `layout`
+    _ecs_arr_t layout;      // _ecs_column_t, in `components` order. Tags have none
+    _ecs_map_t edges;       // Component id -> _ecs_edge_t, filled in as entities move through
+    _ecs_arr_t chunks;      // _ecs_chunk_t, each one holding `chunk_cap` rows of every column
     _ecs_arr_t entities;
-    uint64_t id;
-} _ecs_archetype_t;
+    size_t chunk_cap;
+    uint64_t id;            // XOR of `components`, only a hash: different sets can share it
+    _ecs_archetype_t *collision;    // Next archetype with the same id
+    uint32_t depth;         // Of its entities in the hierarchy, part of what identifies the archetype
+    int freed;              // Set by ecs_compact on the archetypes it is about to free
+};
+
+// The archetypes reached by adding or removing one component
+typedef struct {
+    _ecs_archetype_t *add;
+    _ecs_archetype_t *rem;
+} _ecs_edge_t;
+
+typedef struct {
+    void (*fn)(void *, ecs_id_t *, size_t);
+    void (*range_fn)(void *, ecs_id_t *, size_t, size_t);
+    _ecs_arr_t components;
+    _ecs_arr_t signature;       // Bits of the required `components`, which a matching archetype's signature covers
+    _ecs_arr_t excluded;        // Bits of the `!` components, none of which a matching archetype has
+    _ecs_arr_t writes;          // The components not declared `const`
+    _ecs_arr_t archetypes;      // Every archetype matching `components`, kept up to date as archetypes are created
+    _ecs_arr_t dependents;      // Later systems that conflict with this one
+    size_t dependencies;        // Earlier systems that conflict with this one
+    _ecs_atomic_size_t waiting; // Dependencies not yet finished in the current ecs_run_all
+    _ecs_atomic_u64_t ns;       // ECS_STATS
+    _ecs_atomic_size_t visited;
+    _ecs_atomic_size_t runs;
+} _ecs_system_t;
+
+// Pool tasks either hand rows to a system's function, or run a whole system for ecs_run_all
+enum { _ECS_TASK_ROWS, _ECS_TASK_SYSTEM };
+
+typedef struct {
+    int kind;
+    void (*fn)(void *, ecs_id_t *, size_t);
+    void (*range_fn)(void *, ecs_id_t *, size_t, size_t);
+    ecs_t *ecs;                 // Set for _ECS_TASK_SYSTEM, and for ecs_run_parallel tasks, which are timed one by one
+    size_t system_id;
+    void *components;
+    ecs_id_t *entities;
+    size_t begin;
+    size_t count;
+} _ecs_task_t;
+
+#if defined(ECS_THREADS)
+typedef struct {
+    pthread_mutex_t lock;
+    _ecs_arr_t tasks;   // The owner pops from the back, thieves take from `head`
+    size_t head;
+} _ecs_deque_t;
+
+typedef struct {
+    pthread_t *threads;
+    _ecs_deque_t *deques;
+    int count;
+    int next;
+    int quit;
+    size_t queued;      // Tasks sitting in a deque, each one is claimed before it is taken
+    size_t pending;     // Tasks queued or still running
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+} _ecs_pool_t;
+#else
+// The calling thread, which runs every task as it is submitted
+typedef struct {
+    int count;          // Threads besides the calling one, always 0
+} _ecs_pool_t;
+#endif
 
 typedef struct {
-    uint64_t archetype_id;
+    _ecs_archetype_t *archetype;
     size_t row;
 } _ecs_entity_t;
 
+// An entity's place in the hierarchy, as indices into `ids`. Children are a doubly linked list through `next` and `prev`.
+#define _ecs_no_node    UINT32_MAX
+
+typedef struct {
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next;
+    uint32_t prev;
+} _ecs_node_t;
+
+enum { _ECS_CMD_SPAWN, _ECS_CMD_DESPAWN, _ECS_CMD_SET, _ECS_CMD_REM };
+
+typedef struct {
+    int op;
+    ecs_id_t entity_id;
+    ecs_id_t component_id;
+    size_t stride;
+    size_t offset;      // Where the value starts in the buffer's `data`, SIZE_MAX if there is none
+} _ecs_cmd_t;
+
+typedef struct {
+    _ecs_arr_t cmds;
+    _ecs_arr_t data;
+} _ecs_cmdbuf_t;
+
+// Where ecs_flush takes an entity
+typedef struct {
+    ecs_id_t entity_id;
+    _ecs_archetype_t *src;      // NULL for entities from ecs_cmd_spawn
+    _ecs_archetype_t *dst;      // NULL once despawned
+    size_t ids;                 // Where its sorted component list starts in ecs_flush's scratch ids
+    size_t len;
+    size_t sets;                // Set commands, the most the list can grow by
+} _ecs_move_t;
+
+// Column buffers of up to 4GB are pooled, see _ecs_size_class
+#define _ecs_size_classes   105
+
+// What a pooled column buffer holds while it waits to be reused
+typedef struct _ecs_free_column_t {
+    struct _ecs_free_column_t *next;
+    size_t size;
+} _ecs_free_column_t;
+
 struct ecs_t {
-    _ecs_map_t entities;
-    _ecs_map_t systems;
-    _ecs_map_t archetypes;
+    ecs_allocator_t allocator;
+    _ecs_free_column_t *column_pools[_ecs_size_classes];   // Released column buffers by size class
+    _ecs_arr_t records;     // Where each entity lives, indexed like `ids`
+    _ecs_arr_t nodes;       // _ecs_node_t, indexed like `ids` but only as long as the last index ever given a parent
+    _ecs_map_t components;
+    _ecs_map_t component_bits;  // Component ids, with no value: an id's entry index is its bit in signatures
+    _ecs_arr_t systems;
+    _ecs_arr_t archetypes;  // _ecs_archetype_t *, in creation order, so the archetypes never move
+    _ecs_map_t archetype_index;     // Archetype id -> first _ecs_archetype_t * with it
     _ecs_arr_t ids;
+    _ecs_pool_t *pool;
+    _ecs_arr_t cmdbufs;     // One per pool thread plus one, at index 0, for the thread that owns the world
+    _ecs_atomic_size_t reserved;    // Ids given out by ecs_cmd_spawn past the end of `ids`
+    void *mapped;           // The file image ecs_load made, if columns still point into it
+    size_t mapped_size;
+    size_t transfers;
+    _ecs_map_stats_t map_stats; // Every map of the world points at these
+    size_t compact_next;    // Where ecs_compact_step picks up
+    FILE *trace;
+    _ecs_mutex_t trace_lock;
+    uint64_t trace_origin;
+    ecs_stats_t trace_last; // Counters at the previous ecs_trace_frame
+    int thread_count;
+    int schedule_dirty;
+    uint32_t tick;
     uint32_t next_idx;
-    uint64_t root_archetype_id;
+    _ecs_archetype_t *root;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -149,12 +615,167 @@ static uint64_t _ecs_str_hash(char const *str, uint32_t seed) {
     #undef _ecs_fmix32
 }
 
-static uint64_t _ecs_u64_hash(uint64_t key) {
-    #define _ecs_xorshift(x, i) ((x) ^ ((x) >> (i)))
-    static uint64_t const P = 0x5555555555555555ULL;
-    static uint64_t const C = 17316035218449499591ULL;
-    return C * _ecs_xorshift(P * _ecs_xorshift(key, 32), 32);
-    #undef _ecs_xorshift
+///////////////////////////////////////////////////////////////////////////////
+/// Clock
+
+// Falls back to the processor time from `clock` where <time.h> has no monotonic clock (plain C99)
+static uint64_t _ecs_clock_ns(void) {
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return (uint64_t)((double)clock() * 1e9 / CLOCKS_PER_SEC);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Allocator
+
+#define _ecs_align(x, a)        (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+#if __STDC_VERSION__ >= 201112L
+#define _ecs_alignof(T)         _Alignof (T)
+#define _ecs_min_align          _Alignof (max_align_t)
+
+static void *_ecs_libc_alloc(void *ctx, size_t size, size_t align) {
+    (void)ctx;
+    if (align <= _ecs_min_align)
+        return malloc(size ? size : 1);
+    return aligned_alloc(align, _ecs_align(size ? size : 1, align));
+}
+
+static void *_ecs_libc_realloc(void *ctx, void *ptr, size_t old_size, size_t size) {
+    (void)ctx, (void)old_size;
+    return realloc(ptr, size ? size : 1);
+}
+
+static void _ecs_libc_free(void *ctx, void *ptr, size_t size) {
+    (void)ctx, (void)size;
+    free(ptr);
+}
+#else
+// C99 has neither alignof nor aligned_alloc. Every block is then placed `align` (at least _ecs_min_align) bytes into
+// a larger one from malloc, with the pointer malloc returned stored just before it.
+typedef union {
+    long double ld;
+    long long ll;
+    void *p;
+    void (*fn)(void);
+} _ecs_max_align_t;
+
+#define _ecs_alignof(T)         offsetof(struct { char c; T t; }, t)
+#define _ecs_min_align          _ecs_alignof(_ecs_max_align_t)
+#define _ecs_libc_base(ptr)     (((void **)(ptr))[-1])
+
+static void *_ecs_libc_alloc(void *ctx, size_t size, size_t align) {
+    (void)ctx;
+    if (align < _ecs_min_align) align = _ecs_min_align;
+    char *base = malloc(size + align);
+    if (!base) return NULL;
+
+    char *ptr = base + _ecs_align((size_t)(uintptr_t)base + sizeof (void *), align) - (size_t)(uintptr_t)base;
+    _ecs_libc_base(ptr) = base;
+    return ptr;
+}
+
+// Only ever given blocks aligned to _ecs_min_align, which all sit that many bytes into theirs
+static void *_ecs_libc_realloc(void *ctx, void *ptr, size_t old_size, size_t size) {
+    (void)ctx, (void)old_size;
+    char *base = realloc(ptr ? _ecs_libc_base(ptr) : NULL, size + _ecs_min_align);
+    if (!base) return NULL;
+
+    _ecs_libc_base(base + _ecs_min_align) = base;
+    return base + _ecs_min_align;
+}
+
+static void _ecs_libc_free(void *ctx, void *ptr, size_t size) {
+    (void)ctx, (void)size;
+    if (ptr) free(_ecs_libc_base(ptr));
+}
+#endif
+
+static ecs_allocator_t const _ecs_libc = {_ecs_libc_alloc, _ecs_libc_realloc, _ecs_libc_free, NULL, NULL};
+
+#define _ecs_alloc(a, size, align)              ((a)->alloc((a)->ctx, (size), (align)))
+#define _ecs_realloc(a, ptr, old_size, size)    ((a)->realloc((a)->ctx, (ptr), (old_size), (size)))
+#define _ecs_free(a, ptr, size)                 ((a)->free((a)->ctx, (ptr), (size)))
+
+typedef struct _ecs_arena_block_t {
+    struct _ecs_arena_block_t *next;
+    size_t size;
+    size_t used;
+} _ecs_arena_block_t;
+
+typedef struct {
+    _ecs_arena_block_t *head;
+    size_t block_size;
+} _ecs_arena_t;
+
+static void *_ecs_arena_alloc(void *ctx, size_t size, size_t align) {
+    _ecs_arena_t *arena = ctx;
+    _ecs_arena_block_t *block = arena->head;
+    size_t header = _ecs_align(sizeof *block, _ecs_min_align);
+
+    // Offsets are from the start of the block's data, aligned as addresses
+    uintptr_t base = (uintptr_t)block + header;
+    size_t at = block ? _ecs_align(base + block->used, align) - base : 0;
+
+    if (!block || at + size > block->size) {
+        // Bigger requests get a block of their own
+        size_t block_size = arena->block_size > size + align ? arena->block_size : size + align;
+        block = malloc(header + block_size);
+        if (!block) return NULL;
+
+        *block = (_ecs_arena_block_t){.next = arena->head, .size = block_size};
+        arena->head = block;
+        base = (uintptr_t)block + header;
+        at = _ecs_align(base, align) - base;
+    }
+
+    block->used = at + size;
+    return (char *)base + at;
+}
+
+// Whether `ptr` is the last thing handed out, which can still grow, shrink or be taken back in place
+static int _ecs_arena_last(_ecs_arena_t const *arena, void const *ptr, size_t size) {
+    _ecs_arena_block_t const *block = arena->head;
+    return block && (char const *)ptr + size == (char const *)block + _ecs_align(sizeof *block, _ecs_min_align) + block->used;
+}
+
+static void *_ecs_arena_realloc(void *ctx, void *ptr, size_t old_size, size_t size) {
+    _ecs_arena_t *arena = ctx;
+    if (ptr && _ecs_arena_last(arena, ptr, old_size) && arena->head->used - old_size + size <= arena->head->size) {
+        arena->head->used = arena->head->used - old_size + size;
+        return ptr;
+    }
+
+    void *p = _ecs_arena_alloc(ctx, size, _ecs_min_align);
+    if (p && ptr) memcpy(p, ptr, old_size < size ? old_size : size);
+    return p;
+}
+
+static void _ecs_arena_free(void *ctx, void *ptr, size_t size) {
+    _ecs_arena_t *arena = ctx;
+    if (ptr && _ecs_arena_last(arena, ptr, size))
+        arena->head->used -= size;
+}
+
+static void _ecs_arena_release(void *ctx) {
+    _ecs_arena_t *arena = ctx;
+    for (_ecs_arena_block_t *block = arena->head, *next; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(arena);
+}
+
+ecs_allocator_t ecs_arena(size_t block_size) {
+    _ecs_arena_t *arena = malloc(sizeof *arena);
+    if (!arena) return (ecs_allocator_t){0};
+
+    *arena = (_ecs_arena_t){.block_size = block_size ? block_size : 1 << 20};
+    return (ecs_allocator_t){_ecs_arena_alloc, _ecs_arena_realloc, _ecs_arena_free, _ecs_arena_release, arena};
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -167,22 +788,38 @@ static uint64_t _ecs_u64_hash(uint64_t key) {
     }\
 } while (0)
 
-static _ecs_arr_t _ecs_arr_make(size_t stride, size_t cap) {
+// A NULL allocator means malloc
+static _ecs_arr_t _ecs_arr_make(ecs_allocator_t const *allocator, size_t stride, size_t cap) {
+    if (!allocator) allocator = &_ecs_libc;
     if (cap < 8) cap = 8;
-    return (_ecs_arr_t){
-        .data = calloc(stride, cap),
-        .cap = cap,
-        .stride = stride,
+
+    _ecs_arr_t a = {
+        .data       = _ecs_alloc(allocator, stride * cap, _ecs_min_align),
+        .cap        = cap,
+        .stride     = stride,
+        .allocator  = allocator,
     };
+    memset(a.data, 0, stride * cap);
+    return a;
 }
 
 static void _ecs_arr_reserve(_ecs_arr_t *a, size_t cap) {
     if (cap < a->cap) return;
 
+    size_t old_cap = a->cap;
     while (a->cap <= cap)
         a->cap *= 1.5f;
 
-    a->data = realloc(a->data, a->stride * a->cap);
+    a->data = _ecs_realloc(a->allocator, a->data, a->stride * old_cap, a->stride * a->cap);
+}
+
+// Gives back the room beyond twice the length
+static void _ecs_arr_shrink(_ecs_arr_t *a) {
+    size_t cap = a->len < 8 ? 8 : a->len;
+    if (a->cap <= cap * 2) return;
+
+    a->data = _ecs_realloc(a->allocator, a->data, a->stride * a->cap, a->stride * cap);
+    a->cap = cap;
 }
 
 static void _ecs_arr_set(_ecs_arr_t *a, size_t i, void const *val) {
@@ -213,364 +850,2437 @@ static void *_ecs_arr_pop(_ecs_arr_t *a) {
     (*(T *)_ecs_arr_pop((a)))
 
 static void _ecs_arr_free(_ecs_arr_t *a) {
-    free(a->data);
+    if (a->data) _ecs_free(a->allocator, a->data, a->stride * a->cap);
     a->data = NULL;
     a->cap = a->len = 0;
 }
 
+#define _ecs_map_count(m, counter)\
+    _ecs_stat(if ((m)->stats) _ecs_atomic_count(&(m)->stats->counter, 1))
+
 #define _ecs_map_foreach(k, v, m, ...) do {\
-    for (size_t _i##__LINE__ = 0; _i##__LINE__ < (m).cap; _i##__LINE__++) {\
-        _ecs_map_slot_t *slot = _ecs_arr_get(&(m), _i##__LINE__);\
-        if (slot->dist == 0) continue;\
-        k = slot->key;\
-        v = (void *)(slot + 1);\
+    for (size_t _i##__LINE__ = 0; _i##__LINE__ < (m).len; _i##__LINE__++) {\
+        k = (m).keys[_i##__LINE__];\
+        v = (void *)((m).values + _i##__LINE__ * (m).stride);\
         __VA_ARGS__;\
     }\
 } while (0)
 
 #define _ecs_map_foreachv(v, m, ...)\
-    _ecs_map_foreach(uint64_t _k##__LINE__, v, m, __VA_ARGS__)
+    _ecs_map_foreach(uint64_t _k, v, m, (void)_k; __VA_ARGS__)
 
-static _ecs_map_t _ecs_map_make(size_t stride, size_t cap) {
-    size_t ncap = 8;
-    while (ncap < cap)
-        ncap *= 2;
+#define _ecs_map_empty      0x80
+#define _ecs_map_deleted    0xfe
 
-    stride += sizeof (_ecs_map_slot_t);
-    _ecs_map_t m = _ecs_arr_make(stride, ncap + 2);
-    m.cap -= 2;
+// Bit i of the result is set when control byte i of the group starting at `ctrl` equals `byte`, or for
+// _ecs_map_match_free, is empty or deleted
+#if defined(__AVX2__)
+#define _ecs_map_group      32
 
-    return m;
+static uint32_t _ecs_map_match(uint8_t const *ctrl, uint8_t byte) {
+    __m256i group = _mm256_loadu_si256((__m256i const *)ctrl);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8((char)byte)));
 }
 
-static void _ecs_map_swap(_ecs_map_t *m, _ecs_map_slot_t *a, _ecs_map_slot_t *b) {
-    void *t = _ecs_arr_get(m, m->cap + 1);
-    memcpy(t, a, m->stride);
-    memcpy(a, b, m->stride);
-    memcpy(b, t, m->stride);
+static uint32_t _ecs_map_match_free(uint8_t const *ctrl) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((__m256i const *)ctrl));
 }
+#elif defined(__SSE2__)
+#define _ecs_map_group      16
 
-static void _ecs_map_resize(_ecs_map_t *m, size_t cap) {
-    _ecs_map_t m2 = _ecs_map_make(m->stride - sizeof (_ecs_map_slot_t), cap);
-
-    for (size_t i = 0; i < m->cap; i++) {
-        _ecs_map_slot_t *item = _ecs_arr_get(m, i);
-        if (item->dist == 0) continue;
-
-        for (size_t j = item->key & (m2.cap - 1); ; item->dist++, j = (j + 1) & (m2.cap - 1)) {
-            _ecs_map_slot_t *slot = _ecs_arr_get(&m2, j);
-            if (slot->dist == 0) {
-                m2.len++;
-                memcpy(slot, item, m2.stride);
-                break;
-            }
-            if (slot->dist < item->dist)
-                _ecs_map_swap(m, slot, item);
+static uint32_t _ecs_map_match(uint8_t const *ctrl, uint8_t byte) {
+    __m128i group = _mm_loadu_si128((__m128i const *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+}
+
+static uint32_t _ecs_map_match_free(uint8_t const *ctrl) {
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((__m128i const *)ctrl));
+}
+#else
+#define _ecs_map_group      8
+
+static uint32_t _ecs_map_match(uint8_t const *ctrl, uint8_t byte) {
+    uint32_t bits = 0;
+    for (int i = 0; i < _ecs_map_group; i++)
+        bits |= (uint32_t)(ctrl[i] == byte) << i;
+    return bits;
+}
+
+static uint32_t _ecs_map_match_free(uint8_t const *ctrl) {
+    uint32_t bits = 0;
+    for (int i = 0; i < _ecs_map_group; i++)
+        bits |= (uint32_t)(ctrl[i] >> 7) << i;
+    return bits;
+}
+#endif
+
+// The control byte for `key`. Keys are hashes or entity ids, whose low bits already spread well enough to pick the
+// home slot, but whose top bits (an entity's version) don't, so these come from a multiplicative hash.
+static uint8_t _ecs_map_hash(uint64_t key) {
+    return (key * 0x9e3779b97f4a7c15ull) >> 57;
+}
+
+static void _ecs_map_ctrl(_ecs_map_t *m, size_t slot, uint8_t byte) {
+    m->ctrl[slot] = byte;
+    if (slot < _ecs_map_group)
+        m->ctrl[m->cap + slot] = byte;
+}
+
+// Where `key` is, or -1
+static ptrdiff_t _ecs_map_find(_ecs_map_t const *m, uint64_t key) {
+    _ecs_map_count(m, lookups);
+
+    // Most keys sit in their home slot, which needs no hashing and no group match to check. An empty home slot also
+    // means the key isn't anywhere, since inserting would have taken it.
+    size_t home = key & (m->cap - 1);
+    _ecs_map_count(m, probes);
+    if (m->ctrl[home] == _ecs_map_empty)
+        return -1;
+    if (!(m->ctrl[home] & 0x80) && m->slots[home].key == key)
+        return home;
+
+    uint8_t tag = _ecs_map_hash(key);
+    for (size_t pos = home, step = 0; ; step += _ecs_map_group, pos = (pos + step) & (m->cap - 1)) {
+        _ecs_map_count(m, probes);
+
+        for (uint32_t bits = _ecs_map_match(m->ctrl + pos, tag); bits; bits &= bits - 1) {
+            size_t slot = (pos + _ecs_ctz(bits)) & (m->cap - 1);
+            if (m->slots[slot].key == key)
+                return slot;
         }
+        if (_ecs_map_match(m->ctrl + pos, _ecs_map_empty))
+            return -1;
+    }
+}
+
+// First empty or deleted slot on `key`'s probe sequence
+static size_t _ecs_map_find_free(_ecs_map_t const *m, uint64_t key) {
+    for (size_t pos = key & (m->cap - 1), step = 0; ; step += _ecs_map_group, pos = (pos + step) & (m->cap - 1)) {
+        uint32_t bits = _ecs_map_match_free(m->ctrl + pos);
+        if (bits)
+            return (pos + _ecs_ctz(bits)) & (m->cap - 1);
     }
+}
+
+static void _ecs_map_alloc_slots(_ecs_map_t *m, size_t cap) {
+    m->cap = cap;
+    m->deleted = 0;
+    m->ctrl = _ecs_alloc(m->allocator, cap + _ecs_map_group, 1);
+    m->slots = _ecs_alloc(m->allocator, cap * sizeof *m->slots, _ecs_min_align);
+    memset(m->ctrl, _ecs_map_empty, cap + _ecs_map_group);
+}
+
+static void _ecs_map_free_slots(_ecs_map_t *m) {
+    _ecs_free(m->allocator, m->slots, m->cap * sizeof *m->slots);
+    _ecs_free(m->allocator, m->ctrl, m->cap + _ecs_map_group);
+}
+
+// A NULL allocator means malloc
+static _ecs_map_t _ecs_map_make(ecs_allocator_t const *allocator, size_t stride, size_t cap) {
+    size_t ncap = _ecs_map_group;
+    while (ncap * 7 / 8 < cap)
+        ncap *= 2;
+
+    _ecs_map_t m = {.stride = stride, .entry_cap = cap, .allocator = allocator ? allocator : &_ecs_libc};
+    _ecs_map_alloc_slots(&m, ncap);
+    m.keys = _ecs_alloc(m.allocator, cap * sizeof *m.keys, _ecs_min_align);
+    m.values = _ecs_alloc(m.allocator, cap * stride, _ecs_min_align);
 
-    free(m->data);
-    *m = m2;
+    return m;
+}
+
+// Rebuilds the slots for `cap` slots. The entries stay where they are.
+static void _ecs_map_resize(_ecs_map_t *m, size_t cap) {
+    _ecs_map_count(m, resizes);
+
+    _ecs_map_free_slots(m);
+    _ecs_map_alloc_slots(m, cap);
+
+    for (size_t i = 0; i < m->len; i++) {
+        size_t slot = _ecs_map_find_free(m, m->keys[i]);
+        _ecs_map_ctrl(m, slot, _ecs_map_hash(m->keys[i]));
+        m->slots[slot] = (_ecs_map_slot_t){m->keys[i], i};
+    }
 }
 
 static void _ecs_map_set(_ecs_map_t *m, uint64_t key, void const *val) {
-    if (m->len * 4 == m->cap * 3)
-        _ecs_map_resize(m, m->cap * 2);
-
-    _ecs_map_slot_t *item = _ecs_arr_get(m, m->cap);
-    item->key = key;
-    item->dist = 1;
-    memcpy(item + 1, val, m->stride - sizeof (_ecs_map_slot_t));
-
-    for (size_t i = item->key & (m->cap - 1); ; item->dist++, i = (i + 1) & (m->cap - 1)) {
-        _ecs_map_slot_t *slot = _ecs_arr_get(m, i);
-        if (slot->dist == 0 || slot->key == item->key) {
-            m->len += (slot->dist == 0);
-            memcpy(slot, item, m->stride);
-            break;
-        }
-        if (slot->dist < item->dist)
-            _ecs_map_swap(m, slot, item);
+    ptrdiff_t found = _ecs_map_find(m, key);
+    if (found >= 0) {
+        if (val) memcpy(m->values + m->slots[found].index * m->stride, val, m->stride);
+        return;
     }
+
+    // Keep at least 1/8 of the slots empty so every probe ends. When it's tombstones filling them, clearing those is
+    // enough.
+    if ((m->len + m->deleted + 1) * 8 > m->cap * 7)
+        _ecs_map_resize(m, (m->len + 1) * 2 > m->cap ? m->cap * 2 : m->cap);
+
+    if (m->len == m->entry_cap) {
+        size_t old_cap = m->entry_cap;
+        m->entry_cap = m->entry_cap ? m->entry_cap * 2 : 4;
+        m->keys = _ecs_realloc(m->allocator, m->keys, old_cap * sizeof *m->keys, m->entry_cap * sizeof *m->keys);
+        m->values = _ecs_realloc(m->allocator, m->values, old_cap * m->stride, m->entry_cap * m->stride);
+    }
+
+    size_t slot = _ecs_map_find_free(m, key);
+    m->deleted -= m->ctrl[slot] == _ecs_map_deleted;
+    _ecs_map_ctrl(m, slot, _ecs_map_hash(key));
+    m->slots[slot] = (_ecs_map_slot_t){key, m->len};
+    m->keys[m->len] = key;
+    if (val) memcpy(m->values + m->len * m->stride, val, m->stride);
+    m->len++;
 }
 
 static void *_ecs_map_get(_ecs_map_t const *m, uint64_t key) {
-    for (size_t i = key & (m->cap - 1); ; i = (i + 1) & (m->cap - 1)) {
-        _ecs_map_slot_t *slot = _ecs_arr_get(m, i);
-        if (slot->dist == 0)
-            return NULL;
-        if (slot->key == key)
-            return slot + 1;
-    }
+    ptrdiff_t slot = _ecs_map_find(m, key);
+    return slot < 0 ? NULL : m->values + m->slots[slot].index * m->stride;
+}
+
+// Position of `key` among the entries, or -1. Entries keep the order they were set in until one is removed.
+static ptrdiff_t _ecs_map_index(_ecs_map_t const *m, uint64_t key) {
+    ptrdiff_t slot = _ecs_map_find(m, key);
+    return slot < 0 ? -1 : (ptrdiff_t)m->slots[slot].index;
 }
 
 #define _ecs_map_get_as(m, key, T)\
     (*(T *)_ecs_map_get((m), (key)))
 
 static void _ecs_map_rem(_ecs_map_t *m, uint64_t key) {
-    for (size_t i = key & (m->cap - 1); ; i = (i + 1) & (m->cap - 1)) {
-        _ecs_map_slot_t *slot = _ecs_arr_get(m, i);
-        if (slot->dist == 0)
-            break;
-        if (slot->key == key) {
-            slot->dist = 0;
-            for (;;) {
-                _ecs_map_slot_t *curr = slot;
-                i = (i + 1) & (m->cap - 1);
-                slot = _ecs_arr_get(m, i);
-                if (slot->dist <= 1) {
-                    curr->dist = 0;
-                    break;
-                }
-                memcpy(curr, slot, m->stride);
-                curr->dist--;
-            }
-            m->len--;
-            if (m->len * 10 == m->cap)
-                _ecs_map_resize(m, m->cap / 2);
-            break;
-        }
+    ptrdiff_t slot = _ecs_map_find(m, key);
+    if (slot < 0) return;
+
+    size_t index = m->slots[slot].index;
+    _ecs_map_ctrl(m, slot, _ecs_map_deleted);
+    m->deleted++;
+
+    // Keep the entries packed by moving the last one into the hole
+    size_t last = --m->len;
+    if (index != last) {
+        m->keys[index] = m->keys[last];
+        memcpy(m->values + index * m->stride, m->values + last * m->stride, m->stride);
+        m->slots[_ecs_map_find(m, m->keys[index])].index = index;
+    }
+
+    if (m->cap > _ecs_map_group && m->len * 8 < m->cap)
+        _ecs_map_resize(m, m->cap / 2);
+}
+
+// Drops the tombstones and sizes the slots and entries for the current length, as _ecs_map_make would
+static void _ecs_map_shrink(_ecs_map_t *m) {
+    size_t cap = _ecs_map_group;
+    while (cap * 7 / 8 < m->len)
+        cap *= 2;
+
+    if (m->entry_cap > m->len) {
+        m->keys = _ecs_realloc(m->allocator, m->keys, m->entry_cap * sizeof *m->keys, m->len * sizeof *m->keys);
+        m->values = _ecs_realloc(m->allocator, m->values, m->entry_cap * m->stride, m->len * m->stride);
+        m->entry_cap = m->len;
     }
+
+    if (m->cap != cap || m->deleted)
+        _ecs_map_resize(m, cap);
 }
 
 static void _ecs_map_free(_ecs_map_t *m) {
-    _ecs_arr_free(m);
+    if (!m->ctrl) return;
+
+    _ecs_free(m->allocator, m->values, m->entry_cap * m->stride);
+    _ecs_free(m->allocator, m->keys, m->entry_cap * sizeof *m->keys);
+    _ecs_map_free_slots(m);
+    *m = (_ecs_map_t){0};
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Archetype
 
-static _ecs_archetype_t _ecs_archetype_make(uint64_t id) {
-    return (_ecs_archetype_t){
-        .components = _ecs_map_make(sizeof (_ecs_arr_t), 0),
-        .entities   = _ecs_arr_make(sizeof (ecs_id_t), 0),
-        .edges      = _ecs_map_make(sizeof (uint64_t), 0),
-        .id         = id
-    };
-}
+#define _ecs_id_idx(x)          ((x) & 0xffffffff)
+#define _ecs_id_ver(x)          (((x) >> 32) & 0xffffffff)
+#define _ecs_id_make(ver, idx)  ((((ecs_id_t)(ver)) << 32) | ((uint32_t)(idx)))
 
-// Initializes `curr` with the correct component arrays.
-// Works going forward (e.g. [A, B] -> [A, B, C]) and backward (e.g. [A, B, C] -> [A, B])
-static void _ecs_archetype_qualify(_ecs_archetype_t *curr, _ecs_archetype_t *next, uint64_t component_id, size_t component_stride, int set) {
-    _ecs_map_foreach(uint64_t key, uint64_t *val, curr->edges, {
-        _ecs_map_set(&next->edges, key, &(uint64_t){next->id ^ key});
+#define _ecs_column_align       ECS_ALIGN
 
-        _ecs_arr_t *curr_arr = _ecs_map_get(&curr->components, key);
-        if (!curr_arr || (!set && key == component_id)) continue;
+static int _ecs_archetype_matches(_ecs_archetype_t const *archetype, _ecs_system_t const *system);
 
-        _ecs_arr_t next_arr = _ecs_arr_make(curr_arr->stride, 0);
-        _ecs_map_set(&next->components, key, &next_arr);
-    });
+// Components get a bit each, numbered from 0 in the order they are first seen, registered or not
+static size_t _ecs_component_bit(ecs_t *ecs, ecs_id_t component_id) {
+    ptrdiff_t bit = _ecs_map_index(&ecs->component_bits, component_id);
+    if (bit >= 0) return bit;
 
-    if (set) {
-        _ecs_map_set(&curr->edges, component_id, &next->id);
-        _ecs_map_set(&next->edges, component_id, &curr->id);
+    _ecs_map_set(&ecs->component_bits, component_id, NULL);
+    return ecs->component_bits.len - 1;
+}
 
-        _ecs_arr_t arr = _ecs_arr_make(component_stride, 0);
-        _ecs_map_set(&next->components, component_id, &arr);
-    }
+static void _ecs_signature_set(_ecs_arr_t *signature, size_t bit) {
+    while (signature->len <= bit / 64)
+        _ecs_arr_push(signature, &(uint64_t){0});
+    ((uint64_t *)signature->data)[bit / 64] |= (uint64_t)1 << bit % 64;
 }
 
-// Gets or creates a new archetype by either combining or removing `curr_archetype_id` and `component_id`
-static uint64_t _ecs_archetype_obtain(uint64_t curr_archetype_id, uint64_t component_id, size_t component_stride, _ecs_map_t *archetypes, int set) {
-    // This will find the next archetype when adding or removing a component
-    //  - If adding a component, curr_archetype_id will not have component_id "in" it yet, so they will combine
-    //  - If removing a component, curr_archetype_id will have component_id "in" it, so it will "take" component_id out
-    // Since XOR is transitive, no archetype will be duplicated even if the same components were added in different orders
-    uint64_t next_archetype_id = curr_archetype_id ^ component_id;
+static int _ecs_signature_has(_ecs_arr_t const *signature, size_t bit) {
+    return bit / 64 < signature->len && ((uint64_t const *)signature->data)[bit / 64] >> bit % 64 & 1;
+}
 
-    _ecs_archetype_t *get = _ecs_map_get(archetypes, next_archetype_id);
-    if (get) return get->id;
+// Whether every bit of `b` is set in `a`
+static int _ecs_signature_covers(_ecs_arr_t const *a, _ecs_arr_t const *b) {
+    uint64_t const *x = (uint64_t const *)a->data, *y = (uint64_t const *)b->data;
+    for (size_t i = 0; i < b->len; i++)
+        if (y[i] & ~(i < a->len ? x[i] : 0)) return 0;
+    return 1;
+}
 
-    _ecs_archetype_t *curr = _ecs_map_get(archetypes, curr_archetype_id);
-    _ecs_archetype_t next = _ecs_archetype_make(next_archetype_id);
+// Whether `a` and `b` have a bit in common
+static int _ecs_signature_intersects(_ecs_arr_t const *a, _ecs_arr_t const *b) {
+    uint64_t const *x = (uint64_t const *)a->data, *y = (uint64_t const *)b->data;
+    for (size_t i = 0; i < a->len && i < b->len; i++)
+        if (x[i] & y[i]) return 1;
+    return 0;
+}
 
-    _ecs_archetype_qualify(curr, &next, component_id, component_stride, set);
+static int _ecs_archetype_has(ecs_t const *ecs, _ecs_archetype_t const *archetype, ecs_id_t component_id) {
+    ptrdiff_t bit = _ecs_map_index(&ecs->component_bits, component_id);
+    return bit >= 0 && _ecs_signature_has(&archetype->signature, bit);
+}
 
-    _ecs_map_set(archetypes, next.id, &next);
-    return next.id;
+static uint64_t _ecs_archetype_hash(ecs_id_t const *component_ids, size_t component_count, uint32_t depth) {
+    uint64_t id = depth * 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < component_count; i++)
+        id ^= component_ids[i];
+    return id;
 }
 
-// Moves an entity and its components between archetypes
-static size_t _ecs_archetype_transfer(uint64_t curr_archetype_id, uint64_t next_archetype_id, size_t curr_row, _ecs_map_t *archetypes) {
-    _ecs_archetype_t *curr = _ecs_map_get(archetypes, curr_archetype_id);
-    _ecs_archetype_t *next = _ecs_map_get(archetypes, next_archetype_id);
-
-    // Swap and pop the entity
-    size_t next_row = _ecs_arr_push(&next->entities, _ecs_arr_get(&curr->entities, curr_row));
-    _ecs_arr_set(&curr->entities, curr_row, _ecs_arr_pop(&curr->entities));
-
-    // Swap and pop the entity's components, taking care if next has fewer component types than curr
-    _ecs_map_foreach(uint64_t key, _ecs_arr_t *curr_arr, curr->components, {
-        _ecs_arr_t *next_arr = _ecs_map_get(&next->components, key);
-        if (next_arr) {
-            _ecs_arr_reserve(next_arr, next_row);
-            _ecs_arr_set(next_arr, next_row, _ecs_arr_get(curr_arr, curr_row));
-            next_arr->len++;
-        }
-        _ecs_arr_set(curr_arr, curr_row, _ecs_arr_pop(curr_arr));
-    });
+// The archetype made of exactly `component_ids`, which must be sorted and unique, at `depth`
+static _ecs_archetype_t *_ecs_archetype_find(ecs_t const *ecs, ecs_id_t const *component_ids, size_t component_count, uint32_t depth) {
+    _ecs_archetype_t **first = _ecs_map_get(&ecs->archetype_index, _ecs_archetype_hash(component_ids, component_count, depth));
 
-    return next_row;
+    for (_ecs_archetype_t *archetype = first ? *first : NULL; archetype; archetype = archetype->collision)
+        if (archetype->components.len == component_count && archetype->depth == depth
+            && !memcmp(archetype->components.data, component_ids, component_count * sizeof (ecs_id_t)))
+            return archetype;
+
+    return NULL;
 }
 
-static void _ecs_archetype_free(_ecs_archetype_t *archetype) {
-    _ecs_map_foreachv(_ecs_arr_t *arr, archetype->components, {
-        _ecs_arr_free(arr);
+// Adds the archetype to a system's list, behind the ones of the same or a lower depth
+static void _ecs_system_match(_ecs_system_t *system, _ecs_archetype_t *archetype) {
+    size_t at = _ecs_arr_push(&system->archetypes, &archetype);
+    _ecs_archetype_t **matched = (_ecs_archetype_t **)system->archetypes.data;
+    for (; at > 0 && matched[at - 1]->depth > archetype->depth; at--)
+        matched[at] = matched[at - 1];
+    matched[at] = archetype;
+}
+
+// Creates the archetype for `component_ids`, which must be sorted, unique and registered, and hands it to the
+// systems that match it
+static _ecs_archetype_t *_ecs_archetype_make(ecs_t *ecs, ecs_id_t const *component_ids, size_t component_count, uint32_t depth) {
+    ecs_allocator_t const *allocator = &ecs->allocator;
+    _ecs_archetype_t *archetype = _ecs_alloc(allocator, sizeof *archetype, _ecs_alignof(_ecs_archetype_t));
+    *archetype = (_ecs_archetype_t){
+        .components = _ecs_arr_make(allocator, sizeof (ecs_id_t), component_count),
+        .signature  = _ecs_arr_make(allocator, sizeof (uint64_t), 0),
+        .columns    = _ecs_map_make(allocator, 0, component_count),
+        .layout     = _ecs_arr_make(allocator, sizeof (_ecs_column_t), component_count),
+        .edges      = _ecs_map_make(allocator, sizeof (_ecs_edge_t), 0),
+        .chunks     = _ecs_arr_make(allocator, sizeof (_ecs_chunk_t), 0),
+        .entities   = _ecs_arr_make(allocator, sizeof (ecs_id_t), 0),
+        .id         = _ecs_archetype_hash(component_ids, component_count, depth),
+        .depth      = depth,
+    };
+    archetype->columns.stats = archetype->edges.stats = &ecs->map_stats;
+
+    for (size_t i = 0; i < component_count; i++) {
+        _ecs_arr_push(&archetype->components, &component_ids[i]);
+        _ecs_signature_set(&archetype->signature, _ecs_component_bit(ecs, component_ids[i]));
+
+        size_t stride = _ecs_map_get_as(&ecs->components, component_ids[i], size_t);
+        if (!stride) continue;
+
+        _ecs_arr_push(&archetype->layout, &(_ecs_column_t){.id = component_ids[i], .stride = stride});
+        _ecs_map_set(&archetype->columns, component_ids[i], NULL);
+    }
+
+    // Same id as an existing archetype: chain it behind that one
+    _ecs_archetype_t **first = _ecs_map_get(&ecs->archetype_index, archetype->id);
+    if (first) {
+        archetype->collision = *first;
+        *first = archetype;
+    } else {
+        _ecs_map_set(&ecs->archetype_index, archetype->id, &archetype);
+    }
+    _ecs_arr_push(&ecs->archetypes, &archetype);
+
+    // Systems only ever look at their cached list, so a new archetype has to be added to the ones it matches
+    _ecs_arr_foreach(_ecs_system_t *system, ecs->systems, {
+        if (_ecs_archetype_matches(archetype, system))
+            _ecs_system_match(system, archetype);
     });
 
-    _ecs_map_free(&archetype->components);
-    _ecs_arr_free(&archetype->entities);
-    _ecs_map_free(&archetype->edges);
-    *archetype = (_ecs_archetype_t){0};
+    return archetype;
 }
 
-#define _ecs_id_idx(x)          ((x) & 0xffffffff)
-#define _ecs_id_ver(x)          (((x) >> 32) & 0xffffffff)
-#define _ecs_id_make(ver, idx)  ((((ecs_id_t)(idx)) << 32) | ((uint32_t)(ver)))
+static _ecs_column_t *_ecs_archetype_column(_ecs_archetype_t const *archetype, ecs_id_t component_id) {
+    ptrdiff_t index = _ecs_map_index(&archetype->columns, component_id);
+    return index < 0 ? NULL : _ecs_arr_get(&archetype->layout, index);
+}
 
-///////////////////////////////////////////////////////////////////////////////
-/// ECS
+// The cached edge for `component_id`, created empty if there is none yet
+static _ecs_edge_t *_ecs_archetype_edge(_ecs_archetype_t *archetype, ecs_id_t component_id) {
+    _ecs_edge_t *edge = _ecs_map_get(&archetype->edges, component_id);
+    if (edge) return edge;
 
-ecs_t *ecs_create(int entity_count_hint) {
-    ecs_t *ecs = malloc(sizeof *ecs);
-    if (!ecs) return NULL;
+    _ecs_map_set(&archetype->edges, component_id, &(_ecs_edge_t){0});
+    return _ecs_map_get(&archetype->edges, component_id);
+}
 
-    ecs->archetypes         = _ecs_map_make(sizeof (_ecs_archetype_t), 0);
-    ecs->systems            = _ecs_map_make(sizeof (void (*)()), 0);
-    ecs->entities           = _ecs_map_make(sizeof (_ecs_entity_t), entity_count_hint);
-    ecs->ids                = _ecs_arr_make(sizeof (ecs_id_t), entity_count_hint);
-    ecs->next_idx           = UINT32_MAX;
-    ecs->root_archetype_id  = 0;
+// Address of `row` in `column`
+static void *_ecs_archetype_cell(_ecs_archetype_t const *archetype, _ecs_column_t const *column, size_t row) {
+    _ecs_chunk_t const *chunk = _ecs_arr_get(&archetype->chunks, row / archetype->chunk_cap);
+    return chunk->data + column->offset + (row % archetype->chunk_cap) * column->stride;
+}
 
-    _ecs_archetype_t root = _ecs_archetype_make(ecs->root_archetype_id);
-    _ecs_map_set(&ecs->archetypes, ecs->root_archetype_id, &root);
+// Bytes needed for `cap` rows of every column, each column starting on its own cache line
+static size_t _ecs_archetype_chunk_size(_ecs_archetype_t const *archetype, size_t cap) {
+    size_t size = 0;
+    _ecs_arr_foreach(_ecs_column_t const *column, archetype->layout, {
+        size += _ecs_align(column->stride * cap, _ecs_column_align);
+    });
+    return size;
+}
 
-    return ecs;
+static _ecs_chunk_t _ecs_chunk_make(ecs_t *ecs, _ecs_archetype_t *archetype) {
+    size_t size = (archetype->layout.len ? archetype->layout.len : 1) * sizeof (uint32_t);
+    _ecs_chunk_t chunk = {
+        .archetype  = archetype,
+        .changed    = _ecs_alloc(&ecs->allocator, size, _ecs_alignof(uint32_t)),
+        .added      = _ecs_alloc(&ecs->allocator, size, _ecs_alignof(uint32_t)),
+    };
+    memset(chunk.changed, 0, size);
+    memset(chunk.added, 0, size);
+    return chunk;
 }
 
-void ecs_delete(ecs_t *ecs) {
-    _ecs_map_foreachv(_ecs_archetype_t *archetype, ecs->archetypes, {
-        _ecs_archetype_free(archetype);
-    });
+// Column buffers are rounded up to one of four sizes per power of two, so at most a quarter bigger than asked for.
+// Released buffers are kept per size class and handed out again before asking the allocator.
+static size_t _ecs_size_class(size_t size, size_t *rounded) {
+    if (size <= _ecs_column_align) {
+        *rounded = _ecs_column_align;
+        return 0;
+    }
 
-    _ecs_map_free(&ecs->archetypes);
-    _ecs_map_free(&ecs->systems);
-    _ecs_map_free(&ecs->entities);
-    _ecs_arr_free(&ecs->ids);
-    free(ecs);
+    int bits = 63 - _ecs_clzll(size - 1);
+    size_t step = (size_t)1 << (bits - 2), sub = ((size - 1) >> (bits - 2)) & 3;
+    *rounded = (5 + sub) * step;
+    return 1 + (bits - 6) * 4 + sub;
 }
 
-ecs_id_t _ecs_register(ecs_t *ecs, void (*fn)(void *, ecs_id_t *, size_t), char const *components) {
-    char *dup = strdup(components);
-    ecs_id_t system_id = ecs->root_archetype_id;
-    for (char const *tok = strtok(dup, ", "); tok; tok = strtok(NULL, ", "))
-        system_id ^= _ecs_str_hash(tok, 0); // Combine the component hashes so system_id would be equal to the corresponding archetype_id
-    free(dup);
+static char *_ecs_chunk_alloc(ecs_t *ecs, size_t size) {
+    size_t rounded, class = _ecs_size_class(size, &rounded);
 
-    _ecs_map_set(&ecs->systems, system_id, &fn);
-    return system_id;
+    if (class < _ecs_size_classes && ecs->column_pools[class]) {
+        _ecs_free_column_t *column = ecs->column_pools[class];
+        ecs->column_pools[class] = column->next;
+        return (char *)column;
+    }
+
+    return _ecs_alloc(&ecs->allocator, rounded, _ecs_column_align);
 }
 
-ecs_id_t ecs_spawn(ecs_t *ecs) {
-    ecs_id_t entity_id = 0;
+static void _ecs_chunk_release(ecs_t *ecs, char *data, size_t size) {
+    size_t rounded, class = _ecs_size_class(size, &rounded);
 
-    // Creates or recycles an entity. See https://skypjack.github.io/2019-05-06-ecs-baf-part-3/
-    if (ecs->next_idx < UINT32_MAX) {
-        ecs_id_t tmp = _ecs_arr_get_as(&ecs->ids, ecs->next_idx, ecs_id_t);
-        uint32_t idx = ecs->next_idx;
-        ecs->next_idx = _ecs_id_idx(tmp);
-        entity_id = _ecs_id_make(_ecs_id_ver(tmp), idx);
-        _ecs_arr_set(&ecs->ids, idx, &entity_id);
+    if (class < _ecs_size_classes) {
+        _ecs_free_column_t *column = (_ecs_free_column_t *)data;
+        *column = (_ecs_free_column_t){ecs->column_pools[class], rounded};
+        ecs->column_pools[class] = column;
     } else {
-        entity_id = _ecs_arr_push(&ecs->ids, &ecs->ids.len);
+        _ecs_free(&ecs->allocator, data, rounded);
     }
+}
 
-    _ecs_archetype_t *root = _ecs_map_get(&ecs->archetypes, ecs->root_archetype_id);
-    size_t row = _ecs_arr_push(&root->entities, &entity_id);
-    _ecs_map_set(&ecs->entities, _ecs_u64_hash(entity_id), &(_ecs_entity_t){.archetype_id = ecs->root_archetype_id, .row = row});
-
-    return entity_id;
+// Hands every pooled column buffer back to the allocator
+static void _ecs_chunk_drain(ecs_t *ecs) {
+    for (size_t i = 0; i < _ecs_size_classes; i++) {
+        while (ecs->column_pools[i]) {
+            _ecs_free_column_t *column = ecs->column_pools[i];
+            ecs->column_pools[i] = column->next;
+            _ecs_free(&ecs->allocator, column, column->size);
+        }
+    }
 }
 
-void ecs_despawn(ecs_t *ecs, ecs_id_t entity_id) {
-    uint64_t hash = _ecs_u64_hash(entity_id);
+static void _ecs_chunk_free(ecs_t *ecs, _ecs_chunk_t *chunk) {
+    _ecs_archetype_t const *archetype = chunk->archetype;
+    size_t size = (archetype->layout.len ? archetype->layout.len : 1) * sizeof (uint32_t);
 
-    _ecs_entity_t *entity = _ecs_map_get(&ecs->entities, hash);
-    if (!entity) return;
+    if (chunk->data && !chunk->mapped)
+        _ecs_chunk_release(ecs, chunk->data, _ecs_archetype_chunk_size(archetype, archetype->chunk_cap));
+    _ecs_free(&ecs->allocator, chunk->added, size);
+    _ecs_free(&ecs->allocator, chunk->changed, size);
+}
 
-    // Transfer the entity to the root component to remove the components then pop the most recently added entity from root (which will be this entity)
-    _ecs_archetype_transfer(entity->archetype_id, ecs->root_archetype_id, entity->row, &ecs->archetypes);
-    _ecs_archetype_t *root = _ecs_map_get(&ecs->archetypes, ecs->root_archetype_id);
-    _ecs_arr_pop(&root->entities);
+#if !ECS_CHUNK_SIZE
+// Reallocates the archetype's single chunk for `cap` rows and copies every column to its new offset
+static void _ecs_archetype_resize(ecs_t *ecs, _ecs_archetype_t *archetype, size_t cap) {
+    if (!archetype->chunks.len) {
+        _ecs_chunk_t chunk = _ecs_chunk_make(ecs, archetype);
+        _ecs_arr_push(&archetype->chunks, &chunk);
+    }
 
-    _ecs_map_rem(&ecs->entities, hash);
+    _ecs_chunk_t *chunk = _ecs_arr_get(&archetype->chunks, 0);
+    char *data = _ecs_chunk_alloc(ecs, _ecs_archetype_chunk_size(archetype, cap));
 
-    // Increment this index's version
-    _ecs_arr_set(&ecs->ids, _ecs_id_idx(entity_id), &(ecs_id_t){_ecs_id_make(_ecs_id_ver(entity_id) + 1, _ecs_id_idx(entity_id))});
-    ecs->next_idx = _ecs_id_idx(entity_id);
-}
+    size_t offset = 0;
+    _ecs_arr_foreach(_ecs_column_t *column, archetype->layout, {
+        if (chunk->data)
+            memcpy(data + offset, chunk->data + column->offset, archetype->entities.len * column->stride);
+        column->offset = offset;
+        offset += _ecs_align(column->stride * cap, _ecs_column_align);
+    });
 
-void _ecs_set(ecs_t *ecs, ecs_id_t entity_id, char const *component_name, size_t component_stride, void const *data) {
-    _ecs_entity_t *entity = _ecs_map_get(&ecs->entities, _ecs_u64_hash(entity_id));
-    if (!entity) return;
+    if (chunk->data && !chunk->mapped)
+        _ecs_chunk_release(ecs, chunk->data, _ecs_archetype_chunk_size(archetype, archetype->chunk_cap));
+    chunk->data = data;
+    chunk->mapped = 0;
+    archetype->chunk_cap = cap;
+}
+#endif
+
+// Makes room for `rows` rows. With ECS_CHUNK_SIZE, chunks are added and existing rows never move. Otherwise the
+// archetype's single chunk is resized.
+static void _ecs_archetype_reserve(ecs_t *ecs, _ecs_archetype_t *archetype, size_t rows) {
+#if ECS_CHUNK_SIZE
+    if (!archetype->chunk_cap) {
+        // As many rows as fit in ECS_CHUNK_SIZE bytes, at least one
+        size_t row_size = 0;
+        _ecs_arr_foreach(_ecs_column_t const *column, archetype->layout, {
+            row_size += column->stride;
+        });
+
+        size_t cap = ECS_CHUNK_SIZE / (row_size ? row_size : sizeof (ecs_id_t));
+        while (cap > 1 && _ecs_archetype_chunk_size(archetype, cap) > ECS_CHUNK_SIZE)
+            cap--;
+        archetype->chunk_cap = cap ? cap : 1;
+
+        size_t offset = 0;
+        _ecs_arr_foreach(_ecs_column_t *column, archetype->layout, {
+            column->offset = offset;
+            offset += _ecs_align(column->stride * archetype->chunk_cap, _ecs_column_align);
+        });
+    }
 
-    uint64_t component_id = _ecs_str_hash(component_name, 0);
-    uint64_t curr_id = entity->archetype_id;
+    while (archetype->chunks.len * archetype->chunk_cap < rows) {
+        _ecs_chunk_t chunk = _ecs_chunk_make(ecs, archetype);
+        chunk.data = _ecs_chunk_alloc(ecs, _ecs_archetype_chunk_size(archetype, archetype->chunk_cap));
+        _ecs_arr_push(&archetype->chunks, &chunk);
+    }
+#else
+    if (rows <= archetype->chunk_cap) return;
 
-    entity->archetype_id = _ecs_archetype_obtain(curr_id, component_id, component_stride, &ecs->archetypes, 1);
-    entity->row = _ecs_archetype_transfer(curr_id, entity->archetype_id, entity->row, &ecs->archetypes);
+    size_t cap = archetype->chunk_cap ? archetype->chunk_cap : 8;
+    while (cap < rows)
+        cap += cap / 2;
 
-    _ecs_archetype_t *archetype = _ecs_map_get(&ecs->archetypes, entity->archetype_id);
-    _ecs_arr_t *arr = _ecs_map_get(&archetype->components, component_id);
+    _ecs_archetype_resize(ecs, archetype, cap);
+#endif
+}
 
-    _ecs_arr_reserve(arr, entity->row);
-    _ecs_arr_set(arr, entity->row, data);
-    arr->len++;
+// Gives back the room the archetype's rows don't need: the chunks past the last row or, with ECS_CHUNK_SIZE 0, the
+// capacity beyond twice the rows
+static void _ecs_archetype_shrink(ecs_t *ecs, _ecs_archetype_t *archetype) {
+    size_t rows = archetype->entities.len;
+#if ECS_CHUNK_SIZE
+    size_t keep = archetype->chunk_cap ? (rows + archetype->chunk_cap - 1) / archetype->chunk_cap : 0;
+    while (archetype->chunks.len > keep)
+        _ecs_chunk_free(ecs, _ecs_arr_pop(&archetype->chunks));
+#else
+    if (!rows) {
+        _ecs_arr_foreach(_ecs_chunk_t *chunk, archetype->chunks, {
+            _ecs_chunk_free(ecs, chunk);
+        });
+        archetype->chunks.len = 0;
+        archetype->chunk_cap = 0;
+    } else if (rows * 2 < archetype->chunk_cap) {
+        _ecs_archetype_resize(ecs, archetype, rows < 8 ? 8 : rows);
+    }
+#endif
+    _ecs_arr_shrink(&archetype->chunks);
+    _ecs_arr_shrink(&archetype->entities);
 }
 
-void *_ecs_get(ecs_t *ecs, ecs_id_t entity_id, char const *component_name) {
-    _ecs_entity_t *entity = _ecs_map_get(&ecs->entities, _ecs_u64_hash(entity_id));
-    if (!entity) return NULL;
+// Stamps the chunks holding rows [row, row + count) of `column`, or of every column if it is NULL, with `tick`
+static void _ecs_archetype_touch(_ecs_archetype_t *archetype, _ecs_column_t const *column, size_t row, size_t count, uint32_t tick, int added) {
+    if (!count) return;
 
-    uint64_t component_id = _ecs_str_hash(component_name, 0);
-    _ecs_archetype_t *archetype = _ecs_map_get(&ecs->archetypes, entity->archetype_id);
-    _ecs_arr_t *arr = _ecs_map_get(&archetype->components, component_id);
-    return _ecs_arr_get(arr, entity->row);
+    size_t first = column ? (size_t)(column - (_ecs_column_t const *)archetype->layout.data) : 0;
+    size_t last = column ? first + 1 : archetype->layout.len;
+
+    for (size_t c = row / archetype->chunk_cap; c <= (row + count - 1) / archetype->chunk_cap; c++) {
+        _ecs_chunk_t *chunk = _ecs_arr_get(&archetype->chunks, c);
+        for (size_t i = first; i < last; i++) {
+            chunk->changed[i] = tick;
+            if (added) chunk->added[i] = tick;
+        }
+    }
 }
 
-void _ecs_rem(ecs_t *ecs, ecs_id_t entity_id, char const *component_name) {
-    _ecs_entity_t *entity = _ecs_map_get(&ecs->entities, _ecs_u64_hash(entity_id));
-    if (!entity) return;
+// Writes one value and stamps its chunk
+static void _ecs_archetype_write(ecs_t *ecs, _ecs_archetype_t *archetype, _ecs_column_t const *column, size_t row, void const *data) {
+    memcpy(_ecs_archetype_cell(archetype, column, row), data, column->stride);
+    _ecs_archetype_touch(archetype, column, row, 1, ecs->tick, 0);
+}
 
-    uint64_t component_id = _ecs_str_hash(component_name, 0);
-    uint64_t curr_id = entity->archetype_id;
+// Copies `count` values from `data` into `column` starting at `row`, or zeroes them if `data` is NULL.
+// Runs crossing a chunk boundary are split so each chunk gets one block copy.
+static void _ecs_archetype_fill(_ecs_archetype_t *archetype, _ecs_column_t const *column, size_t row, size_t count, void const *data) {
+    for (size_t done = 0; done < count;) {
+        size_t run = archetype->chunk_cap - (row + done) % archetype->chunk_cap;
+        if (run > count - done) run = count - done;
+
+        void *dst = _ecs_archetype_cell(archetype, column, row + done);
+        if (data)
+            memcpy(dst, (char const *)data + done * column->stride, run * column->stride);
+        else
+            memset(dst, 0, run * column->stride);
 
-    entity->archetype_id = _ecs_archetype_obtain(curr_id, component_id, 0, &ecs->archetypes, 0);
-    entity->row = _ecs_archetype_transfer(curr_id, entity->archetype_id, entity->row, &ecs->archetypes);
+        done += run;
+    }
+}
+
+// Whether `archetype` has every component `system` requires and none it excludes
+static int _ecs_archetype_matches(_ecs_archetype_t const *archetype, _ecs_system_t const *system) {
+    return _ecs_signature_covers(&archetype->signature, &system->signature)
+        && !_ecs_signature_intersects(&archetype->signature, &system->excluded);
 }
 
-static void _ecs_run(ecs_t *ecs, _ecs_archetype_t *archetype, void (*fn)(void *, ecs_id_t *, size_t), int num_component_types) {
-    if (!archetype || archetype->components.len < num_component_types) return;
+// Whether `component_ids[i]` changes `curr` when added (`set`) or removed (`!set`). Skips earlier duplicates and,
+// when adding, components that were never registered
+static int _ecs_archetype_affects(ecs_t *ecs, _ecs_archetype_t const *curr, ecs_id_t const *component_ids, size_t i, int set) {
+    for (size_t j = 0; j < i; j++)
+        if (component_ids[j] == component_ids[i])
+            return 0;
 
-    if (archetype->entities.len)
-        fn(&archetype->components, (ecs_id_t *)archetype->entities.data, archetype->entities.len);
+    if (set && !_ecs_map_get(&ecs->components, component_ids[i]))
+        return 0;
 
-    _ecs_map_foreachv(uint64_t *edge, archetype->edges, {
-        _ecs_run(ecs, _ecs_map_get(&ecs->archetypes, *edge), fn, archetype->components.len);
-    });
+    return !_ecs_archetype_has(ecs, curr, component_ids[i]) == !!set;
 }
 
-void ecs_run(ecs_t *ecs, ecs_id_t system_id) {
-    void (**fn)(void *, ecs_id_t *, size_t) = _ecs_map_get(&ecs->systems, system_id);
-    if (!fn) return;
+// Gets or creates the archetype made of `curr`'s components plus (`set`) or minus (`!set`) `component_ids`, at
+// `curr`'s depth.
+// The destination is created directly, without the intermediate archetypes of adding the components one at a time.
+// Single component moves are remembered as edges on both archetypes, so after the first time they cost one lookup.
+static _ecs_archetype_t *_ecs_archetype_obtain(ecs_t *ecs, _ecs_archetype_t *curr, size_t component_count, ecs_id_t const *component_ids, int set) {
+    if (component_count == 1) {
+        _ecs_edge_t const *edge = _ecs_map_get(&curr->edges, component_ids[0]);
+        _ecs_archetype_t *next = edge ? (set ? edge->add : edge->rem) : NULL;
+        if (next) return next;
+    }
 
-    _ecs_run(ecs, _ecs_map_get(&ecs->archetypes, system_id), *fn, 0);
-}
+    // Work out the sorted component list of the destination
+    _ecs_arr_t next_ids = _ecs_arr_make(NULL, sizeof (ecs_id_t), curr->components.len + (set ? component_count : 0));
+    _ecs_arr_foreach(ecs_id_t const *component_id, curr->components, {
+        int removed = 0;
+        for (size_t i = 0; !set && i < component_count; i++)
+            removed |= component_ids[i] == *component_id;
+        if (!removed)
+            _ecs_arr_push(&next_ids, component_id);
+    });
+
+    int changed = next_ids.len != curr->components.len;
+    for (size_t i = 0; set && i < component_count; i++) {
+        if (!_ecs_archetype_affects(ecs, curr, component_ids, i, set)) continue;
+
+        size_t at = _ecs_arr_push(&next_ids, &component_ids[i]);
+        ecs_id_t *ids = (ecs_id_t *)next_ids.data;
+        for (; at > 0 && ids[at - 1] > component_ids[i]; at--)
+            ids[at] = ids[at - 1];
+        ids[at] = component_ids[i];
+        changed = 1;
+    }
+
+    _ecs_archetype_t *next = curr;
+    if (changed) {
+        next = _ecs_archetype_find(ecs, (ecs_id_t *)next_ids.data, next_ids.len, curr->depth);
+        if (!next) next = _ecs_archetype_make(ecs, (ecs_id_t *)next_ids.data, next_ids.len, curr->depth);
+    }
+    _ecs_arr_free(&next_ids);
+
+    if (component_count == 1 && next != curr) {
+        _ecs_archetype_t *from = set ? curr : next, *to = set ? next : curr;
+        _ecs_archetype_edge(from, component_ids[0])->add = to;
+        _ecs_archetype_edge(to, component_ids[0])->rem = from;
+    }
+
+    return next;
+}
+
+// Gets or creates the archetype with `curr`'s components at `depth`
+static _ecs_archetype_t *_ecs_archetype_at_depth(ecs_t *ecs, _ecs_archetype_t *curr, uint32_t depth) {
+    _ecs_archetype_t *next = _ecs_archetype_find(ecs, (ecs_id_t *)curr->components.data, curr->components.len, depth);
+    return next ? next : _ecs_archetype_make(ecs, (ecs_id_t *)curr->components.data, curr->components.len, depth);
+}
+
+// Swaps the last row into `row` and pops it, then points the moved entity's record at its new row
+static void _ecs_archetype_remove(ecs_t *ecs, _ecs_archetype_t *archetype, size_t row) {
+    size_t last = archetype->entities.len - 1;
+
+    if (row != last) {
+        _ecs_arr_foreach(_ecs_column_t const *column, archetype->layout, {
+            memcpy(_ecs_archetype_cell(archetype, column, row), _ecs_archetype_cell(archetype, column, last), column->stride);
+        });
+        _ecs_archetype_touch(archetype, NULL, row, 1, ecs->tick, 0);
+    }
+
+    _ecs_arr_set(&archetype->entities, row, _ecs_arr_pop(&archetype->entities));
+
+    if (row < archetype->entities.len) {
+        ecs_id_t moved = _ecs_arr_get_as(&archetype->entities, row, ecs_id_t);
+        _ecs_arr_get_as(&ecs->records, _ecs_id_idx(moved), _ecs_entity_t).row = row;
+    }
+}
+
+// Moves an entity and its components between archetypes
+static size_t _ecs_archetype_transfer(ecs_t *ecs, _ecs_archetype_t *curr, _ecs_archetype_t *next, size_t curr_row) {
+    _ecs_stat(ecs->transfers++);
+    size_t next_row = next->entities.len;
+    _ecs_archetype_reserve(ecs, next, next_row + 1);
+    _ecs_arr_push(&next->entities, _ecs_arr_get(&curr->entities, curr_row));
+
+    // Copy the components both archetypes have and zero the ones only next has. The ones only in curr are dropped
+    // by the swap and pop
+    _ecs_arr_foreach(_ecs_column_t const *next_column, next->layout, {
+        _ecs_column_t const *curr_column = _ecs_archetype_column(curr, next_column->id);
+        void *cell = _ecs_archetype_cell(next, next_column, next_row);
+
+        if (curr_column)
+            memcpy(cell, _ecs_archetype_cell(curr, curr_column, curr_row), next_column->stride);
+        else
+            memset(cell, 0, next_column->stride);
+
+        _ecs_archetype_touch(next, next_column, next_row, 1, ecs->tick, !curr_column);
+    });
+
+    _ecs_archetype_remove(ecs, curr, curr_row);
+    return next_row;
+}
+
+// Takes the archetype out of the index and off the edges of its neighbours, so nothing finds it anymore. Every edge
+// pointing at it has its reverse in `edges`, since _ecs_archetype_obtain always caches both.
+static void _ecs_archetype_unlink(ecs_t *ecs, _ecs_archetype_t *archetype) {
+    _ecs_archetype_t **first = _ecs_map_get(&ecs->archetype_index, archetype->id), **link = first;
+    while (*link != archetype)
+        link = &(*link)->collision;
+
+    if (link == first && !archetype->collision)
+        _ecs_map_rem(&ecs->archetype_index, archetype->id);
+    else
+        *link = archetype->collision;
+
+    _ecs_map_foreach(uint64_t component_id, _ecs_edge_t const *edge, archetype->edges, {
+        _ecs_archetype_t *neighbours[2] = {edge->add, edge->rem};
+        for (int i = 0; i < 2; i++) {
+            if (!neighbours[i]) continue;
+
+            _ecs_edge_t *back = _ecs_map_get(&neighbours[i]->edges, component_id);
+            if (back->add == archetype) back->add = NULL;
+            if (back->rem == archetype) back->rem = NULL;
+            if (!back->add && !back->rem)
+                _ecs_map_rem(&neighbours[i]->edges, component_id);
+        }
+    });
+}
+
+static void _ecs_archetype_free(ecs_t *ecs, _ecs_archetype_t *archetype) {
+    _ecs_arr_foreach(_ecs_chunk_t *chunk, archetype->chunks, {
+        _ecs_chunk_free(ecs, chunk);
+    });
+
+    _ecs_arr_free(&archetype->components);
+    _ecs_arr_free(&archetype->signature);
+    _ecs_map_free(&archetype->columns);
+    _ecs_arr_free(&archetype->layout);
+    _ecs_map_free(&archetype->edges);
+    _ecs_arr_free(&archetype->chunks);
+    _ecs_arr_free(&archetype->entities);
+    _ecs_free(&ecs->allocator, archetype, sizeof *archetype);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Thread pool
+
+#if defined(ECS_STATS)
+static void _ecs_stats_record(ecs_t *ecs, size_t system_id, uint64_t start, uint64_t end, size_t rows);
+#endif
+static void _ecs_schedule_exec(ecs_t *ecs, size_t system_id);
+
+static void _ecs_task_exec(_ecs_task_t const *task) {
+    if (task->kind == _ECS_TASK_SYSTEM) {
+        _ecs_schedule_exec(task->ecs, task->system_id);
+        return;
+    }
+
+    _ecs_stat(uint64_t start = task->ecs ? _ecs_clock_ns() : 0);
+
+    if (task->range_fn)
+        task->range_fn(task->components, task->entities, task->begin, task->count);
+    else
+        task->fn(task->components, task->entities, task->count);
+
+    _ecs_stat(if (task->ecs) _ecs_stats_record(task->ecs, task->system_id, start, _ecs_clock_ns(), task->count));
+}
+
+#if defined(ECS_THREADS)
+// Set on pool threads so they can find their own command buffer
+static _Thread_local _ecs_pool_t *_ecs_thread_pool;
+static _Thread_local int _ecs_thread_self;
+
+// The calling thread's index in `pool` plus one, or 0 if it isn't one of its threads
+static int _ecs_pool_slot(_ecs_pool_t const *pool) {
+    return pool && _ecs_thread_pool == pool ? _ecs_thread_self + 1 : 0;
+}
+
+// Takes a task from deque `self`, or steals the oldest one from another deque
+static int _ecs_pool_take(_ecs_pool_t *pool, int self, _ecs_task_t *task) {
+    for (int i = 0; i < pool->count; i++) {
+        _ecs_deque_t *deque = &pool->deques[(self + i) % pool->count];
+        int found = 0;
+
+        pthread_mutex_lock(&deque->lock);
+        if (deque->head < deque->tasks.len) {
+            found = 1;
+            if (i == 0)
+                *task = _ecs_arr_pop_as(&deque->tasks, _ecs_task_t);
+            else
+                *task = _ecs_arr_get_as(&deque->tasks, deque->head++, _ecs_task_t);
+
+            if (deque->head == deque->tasks.len)
+                deque->head = deque->tasks.len = 0;
+        }
+        pthread_mutex_unlock(&deque->lock);
+
+        if (found) return 1;
+    }
+
+    return 0;
+}
+
+// Claims a queued task and runs it. Expects `pool->lock` to be held and `pool->queued` to be non-zero
+static void _ecs_pool_work(_ecs_pool_t *pool, int self) {
+    pool->queued--;
+    pthread_mutex_unlock(&pool->lock);
+
+    // The claim guarantees a task is left for us somewhere, so this only spins while another thread is mid-take
+    _ecs_task_t task;
+    while (!_ecs_pool_take(pool, self, &task));
+    _ecs_task_exec(&task);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0)
+        pthread_cond_broadcast(&pool->done);
+}
+
+static int _ecs_pool_self(_ecs_pool_t *pool, pthread_t thread) {
+    for (int i = 0; i < pool->count; i++)
+        if (pthread_equal(pool->threads[i], thread))
+            return i;
+    return 0;
+}
+
+static void *_ecs_pool_main(void *arg) {
+    _ecs_pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    int self = _ecs_pool_self(pool, pthread_self());
+    _ecs_thread_pool = pool;
+    _ecs_thread_self = self;
+    for (;;) {
+        while (!pool->quit && !pool->queued)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (!pool->queued) break;
+
+        _ecs_pool_work(pool, self);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static _ecs_pool_t *_ecs_pool_make(int count) {
+    if (count <= 0) count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (count <= 0) count = 1;
+
+    _ecs_pool_t *pool = calloc(1, sizeof *pool);
+    pool->threads = calloc(count, sizeof *pool->threads);
+    pool->deques = calloc(count, sizeof *pool->deques);
+    pool->count = count;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->deques[i].tasks = _ecs_arr_make(NULL, sizeof (_ecs_task_t), 0);
+    }
+
+    // Hold the lock so workers only look themselves up once every thread id is written
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < count; i++)
+        pthread_create(&pool->threads[i], NULL, _ecs_pool_main, pool);
+    pthread_mutex_unlock(&pool->lock);
+
+    return pool;
+}
+
+// Spreads the tasks round-robin over the threads' deques and wakes them up
+// Safe to call from inside a task
+static void _ecs_pool_submit(_ecs_pool_t *pool, _ecs_task_t const *tasks, size_t count) {
+    pthread_mutex_lock(&pool->lock);
+    int next = pool->next;
+    pool->next = (next + count) % pool->count;
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < count; i++) {
+        _ecs_deque_t *deque = &pool->deques[(next + i) % pool->count];
+
+        pthread_mutex_lock(&deque->lock);
+        _ecs_arr_push(&deque->tasks, &tasks[i]);
+        pthread_mutex_unlock(&deque->lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued += count;
+    pool->pending += count;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Waits for every submitted task, running queued ones on the calling thread meanwhile
+static void _ecs_pool_join(_ecs_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued)
+        _ecs_pool_work(pool, 0);
+    while (pool->pending)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void _ecs_pool_free(_ecs_pool_t *pool) {
+    _ecs_pool_join(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (int i = 0; i < pool->count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        _ecs_arr_free(&pool->deques[i].tasks);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
+#else
+static int _ecs_pool_slot(_ecs_pool_t const *pool) {
+    (void)pool;
+    return 0;
+}
+
+static _ecs_pool_t *_ecs_pool_make(int count) {
+    (void)count;
+    return calloc(1, sizeof (_ecs_pool_t));
+}
+
+// Tasks submitted from inside a task run right away too, nested in it
+static void _ecs_pool_submit(_ecs_pool_t *pool, _ecs_task_t const *tasks, size_t count) {
+    (void)pool;
+    for (size_t i = 0; i < count; i++)
+        _ecs_task_exec(&tasks[i]);
+}
+
+static void _ecs_pool_join(_ecs_pool_t *pool) {
+    (void)pool;
+}
+
+static void _ecs_pool_free(_ecs_pool_t *pool) {
+    free(pool);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// File images
+
+// The whole file at `path` in memory that can be written to, starting on a column boundary, or NULL
+#if defined(ECS_MMAP)
+static char *_ecs_image_load(char const *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    *size = (size_t)st.st_size;
+    return map;
+}
+
+static void _ecs_image_free(void *data, size_t size) {
+    munmap(data, size);
+}
+#else
+static char *_ecs_image_load(char const *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    char *data = NULL;
+    long end = fseek(f, 0, SEEK_END) ? -1 : ftell(f);
+    if (end > 0 && !fseek(f, 0, SEEK_SET)) {
+        data = _ecs_libc_alloc(NULL, (size_t)end, _ecs_column_align);
+        if (data && fread(data, (size_t)end, 1, f) != 1) {
+            _ecs_libc_free(NULL, data, (size_t)end);
+            data = NULL;
+        }
+    }
+    fclose(f);
+
+    *size = (size_t)end;
+    return data;
+}
+
+static void _ecs_image_free(void *data, size_t size) {
+    _ecs_libc_free(NULL, data, size);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// ECS
+
+ecs_t *ecs_create(int entity_count_hint) {
+    return ecs_create_with(entity_count_hint, NULL);
+}
+
+ecs_t *ecs_create_with(int entity_count_hint, ecs_allocator_t const *allocator) {
+    if (!allocator) allocator = &_ecs_libc;
+    if (!allocator->alloc) return NULL;
+    ecs_t *ecs = _ecs_alloc(allocator, sizeof *ecs, _ecs_alignof(ecs_t));
+    if (!ecs) return NULL;
+
+    // Everything the world owns points at its own copy of the allocator
+    ecs->allocator          = *allocator;
+    allocator               = &ecs->allocator;
+    memset(ecs->column_pools, 0, sizeof ecs->column_pools);
+
+    ecs->archetypes         = _ecs_arr_make(allocator, sizeof (_ecs_archetype_t *), 0);
+    ecs->archetype_index    = _ecs_map_make(allocator, sizeof (_ecs_archetype_t *), 0);
+    ecs->components         = _ecs_map_make(allocator, sizeof (size_t), 0);
+    ecs->component_bits     = _ecs_map_make(allocator, 0, 0);
+    ecs->archetype_index.stats = ecs->components.stats = ecs->component_bits.stats = &ecs->map_stats;
+    ecs->systems            = _ecs_arr_make(allocator, sizeof (_ecs_system_t), 0);
+    ecs->records            = _ecs_arr_make(allocator, sizeof (_ecs_entity_t), entity_count_hint);
+    ecs->nodes              = _ecs_arr_make(allocator, sizeof (_ecs_node_t), 0);
+    ecs->ids                = _ecs_arr_make(allocator, sizeof (ecs_id_t), entity_count_hint);
+    ecs->pool               = NULL;
+    ecs->cmdbufs            = _ecs_arr_make(NULL, sizeof (_ecs_cmdbuf_t), 0);
+    ecs->mapped             = NULL;
+    ecs->mapped_size        = 0;
+    ecs->transfers          = 0;
+    _ecs_atomic_init(&ecs->map_stats.lookups, 0);
+    _ecs_atomic_init(&ecs->map_stats.probes, 0);
+    _ecs_atomic_init(&ecs->map_stats.resizes, 0);
+    ecs->compact_next       = 0;
+    ecs->trace              = NULL;
+    ecs->trace_origin       = 0;
+    ecs->thread_count       = 0;
+    ecs->schedule_dirty     = 0;
+    ecs->tick               = 1;
+    ecs->next_idx           = UINT32_MAX;
+    _ecs_atomic_init(&ecs->reserved, 0);
+    _ecs_mutex_init(&ecs->trace_lock);
+
+    _ecs_arr_push(&ecs->cmdbufs, &(_ecs_cmdbuf_t){_ecs_arr_make(NULL, sizeof (_ecs_cmd_t), 0), _ecs_arr_make(NULL, 1, 0)});
+
+    ecs->root = _ecs_archetype_make(ecs, NULL, 0, 0);
+
+    return ecs;
+}
+
+void ecs_delete(ecs_t *ecs) {
+    if (ecs->pool)
+        _ecs_pool_free(ecs->pool);
+
+    if (ecs->mapped)
+        _ecs_image_free(ecs->mapped, ecs->mapped_size);
+
+    ecs_trace_end(ecs);
+    _ecs_mutex_destroy(&ecs->trace_lock);
+
+    // These always come from malloc
+    _ecs_arr_foreach(_ecs_cmdbuf_t *buf, ecs->cmdbufs, {
+        _ecs_arr_free(&buf->cmds);
+        _ecs_arr_free(&buf->data);
+    });
+    _ecs_arr_free(&ecs->cmdbufs);
+
+    // Nothing else needs handing back one block at a time if the allocator can drop everything at once
+    ecs_allocator_t allocator = ecs->allocator;
+    if (allocator.release) {
+        allocator.release(allocator.ctx);
+        return;
+    }
+
+    _ecs_arr_foreach(_ecs_archetype_t **archetype, ecs->archetypes, {
+        _ecs_archetype_free(ecs, *archetype);
+    });
+
+    _ecs_chunk_drain(ecs);
+
+    _ecs_arr_free(&ecs->archetypes);
+    _ecs_map_free(&ecs->archetype_index);
+    _ecs_map_free(&ecs->components);
+    _ecs_map_free(&ecs->component_bits);
+    _ecs_arr_foreach(_ecs_system_t *system, ecs->systems, {
+        _ecs_arr_free(&system->components);
+        _ecs_arr_free(&system->signature);
+        _ecs_arr_free(&system->excluded);
+        _ecs_arr_free(&system->writes);
+        _ecs_arr_free(&system->archetypes);
+        _ecs_arr_free(&system->dependents);
+    });
+
+    _ecs_arr_free(&ecs->systems);
+    _ecs_arr_free(&ecs->records);
+    _ecs_arr_free(&ecs->nodes);
+    _ecs_arr_free(&ecs->ids);
+    _ecs_free(&allocator, ecs, sizeof *ecs);
+}
+
+// Registers the component, or checks that it was registered with the same stride. Two strides for one name mean two
+// translation units disagree on its type, and every copy of its values would be out of bounds for one of them.
+static void _ecs_component_define(ecs_t *ecs, ecs_id_t component_id, size_t component_stride) {
+    size_t const *stride = _ecs_map_get(&ecs->components, component_id);
+    assert((!stride || *stride == component_stride) && "component registered again with a different size");
+    if (!stride)
+        _ecs_map_set(&ecs->components, component_id, &component_stride);
+}
+
+ecs_id_t _ecs_component(ecs_t *ecs, char const *component_name, size_t component_stride) {
+    // The handle is just the name hash, so it is stable across runs and equal to what the string functions compute
+    uint64_t component_id = _ecs_str_hash(component_name, 0);
+    _ecs_component_define(ecs, component_id, component_stride);
+    return component_id;
+}
+
+static ecs_id_t _ecs_system_add(ecs_t *ecs, _ecs_system_t system, char const *components) {
+    system.components = _ecs_arr_make(&ecs->allocator, sizeof (ecs_id_t), 0);
+    system.signature = _ecs_arr_make(&ecs->allocator, sizeof (uint64_t), 0);
+    system.excluded = _ecs_arr_make(&ecs->allocator, sizeof (uint64_t), 0);
+    system.writes = _ecs_arr_make(&ecs->allocator, sizeof (ecs_id_t), 0);
+    system.archetypes = _ecs_arr_make(&ecs->allocator, sizeof (_ecs_archetype_t *), 0);
+    system.dependents = _ecs_arr_make(&ecs->allocator, sizeof (size_t), 0);
+
+    size_t size = strlen(components) + 1;
+    char *dup = memcpy(_ecs_alloc(&ecs->allocator, size, 1), components, size);
+    for (char *tok = strtok(dup, ","); tok; tok = strtok(NULL, ",")) {
+        while (*tok == ' ') tok++;
+        int read_only = !strncmp(tok, "const ", 6);
+        if (read_only) tok += 6;
+        while (*tok == ' ') tok++;
+        char term = *tok == '!' || *tok == '?' ? *tok++ : 0;
+        while (*tok == ' ') tok++;
+        tok[strcspn(tok, " ")] = '\0';
+
+        // Excluded components are only looked at when matching, they aren't accessed
+        ecs_id_t component_id = _ecs_str_hash(tok, 0);
+        if (term == '!') {
+            _ecs_signature_set(&system.excluded, _ecs_component_bit(ecs, component_id));
+            continue;
+        }
+
+        _ecs_arr_push(&system.components, &component_id);
+        if (term != '?')
+            _ecs_signature_set(&system.signature, _ecs_component_bit(ecs, component_id));
+        if (!read_only)
+            _ecs_arr_push(&system.writes, &component_id);
+    }
+    _ecs_free(&ecs->allocator, dup, size);
+
+    // Archetypes created from now on are added by _ecs_archetype_make
+    _ecs_arr_foreach(_ecs_archetype_t **archetype, ecs->archetypes, {
+        if (_ecs_archetype_matches(*archetype, &system))
+            _ecs_system_match(&system, *archetype);
+    });
+
+    ecs->schedule_dirty = 1;
+    return _ecs_arr_push(&ecs->systems, &system);
+}
+
+ecs_id_t _ecs_register(ecs_t *ecs, void (*fn)(void *, ecs_id_t *, size_t), char const *components) {
+    return _ecs_system_add(ecs, (_ecs_system_t){.fn = fn}, components);
+}
+
+ecs_id_t _ecs_register_parallel(ecs_t *ecs, void (*fn)(void *, ecs_id_t *, size_t, size_t), char const *components) {
+    return _ecs_system_add(ecs, (_ecs_system_t){.range_fn = fn}, components);
+}
+
+// Creates or recycles an entity id. See https://skypjack.github.io/2019-05-06-ecs-baf-part-3/
+// Free slots in `ids` hold the next version and, in the index bits, the next free index.
+// Gives the ids handed out by ecs_cmd_spawn their slots, so that no other id is made with the same index. They have
+// no archetype until ecs_flush applies their spawn.
+static void _ecs_id_claim(ecs_t *ecs) {
+    size_t reserved = _ecs_atomic_exchange(&ecs->reserved, 0);
+    _ecs_arr_reserve(&ecs->ids, ecs->ids.len + reserved);
+    _ecs_arr_reserve(&ecs->records, ecs->records.len + reserved);
+    for (size_t i = 0; i < reserved; i++) {
+        _ecs_arr_push(&ecs->records, &(_ecs_entity_t){0});
+        _ecs_arr_push(&ecs->ids, &ecs->ids.len);
+    }
+}
+
+static ecs_id_t _ecs_id_obtain(ecs_t *ecs) {
+    if (ecs->next_idx < UINT32_MAX) {
+        ecs_id_t tmp = _ecs_arr_get_as(&ecs->ids, ecs->next_idx, ecs_id_t);
+        uint32_t idx = ecs->next_idx;
+        ecs->next_idx = _ecs_id_idx(tmp);
+        ecs_id_t entity_id = _ecs_id_make(_ecs_id_ver(tmp), idx);
+        _ecs_arr_set(&ecs->ids, idx, &entity_id);
+        return entity_id;
+    }
+
+    _ecs_id_claim(ecs);
+    _ecs_arr_push(&ecs->records, &(_ecs_entity_t){0});
+    return _ecs_arr_push(&ecs->ids, &ecs->ids.len);
+}
+
+// Bumps the index's version and pushes it on the free list
+static void _ecs_id_release(ecs_t *ecs, ecs_id_t entity_id) {
+    _ecs_arr_set(&ecs->ids, _ecs_id_idx(entity_id), &(ecs_id_t){_ecs_id_make(_ecs_id_ver(entity_id) + 1, ecs->next_idx)});
+    ecs->next_idx = _ecs_id_idx(entity_id);
+}
+
+// The id's record, or NULL if it was despawned. The version in `ids` only matches while the id is in use.
+static _ecs_entity_t *_ecs_record_get(ecs_t const *ecs, ecs_id_t entity_id) {
+    size_t idx = _ecs_id_idx(entity_id);
+    if (idx >= ecs->ids.len || _ecs_arr_get_as(&ecs->ids, idx, ecs_id_t) != entity_id) return NULL;
+    return _ecs_arr_get(&ecs->records, idx);
+}
+
+// The entity's record, or NULL if it isn't alive. Ids from ecs_cmd_spawn only come alive when ecs_flush spawns them,
+// before that their record (if _ecs_id_claim gave them one) has no archetype.
+static _ecs_entity_t *_ecs_entity_get(ecs_t const *ecs, ecs_id_t entity_id) {
+    _ecs_entity_t *entity = _ecs_record_get(ecs, entity_id);
+    return entity && entity->archetype ? entity : NULL;
+}
+
+ecs_id_t ecs_spawn(ecs_t *ecs) {
+    ecs_id_t entity_id = _ecs_id_obtain(ecs);
+
+    _ecs_archetype_t *root = ecs->root;
+    _ecs_archetype_reserve(ecs, root, root->entities.len + 1);
+    size_t row = _ecs_arr_push(&root->entities, &entity_id);
+    _ecs_arr_set(&ecs->records, _ecs_id_idx(entity_id), &(_ecs_entity_t){.archetype = root, .row = row});
+
+    return entity_id;
+}
+
+void ecs_spawn_n(ecs_t *ecs, size_t count, ecs_id_t *entities, size_t component_count, ecs_id_t const *component_ids, void const *const *component_data) {
+    // Resolve the final archetype once instead of walking every entity through it one component at a time
+    _ecs_archetype_t *archetype = _ecs_archetype_obtain(ecs, ecs->root, component_count, component_ids, 1);
+    size_t row = archetype->entities.len;
+
+    _ecs_arr_reserve(&ecs->ids, ecs->ids.len + count);
+    _ecs_arr_reserve(&ecs->records, ecs->records.len + count);
+    _ecs_arr_reserve(&archetype->entities, row + count);
+    _ecs_archetype_reserve(ecs, archetype, row + count);
+
+    for (size_t i = 0; i < count; i++) {
+        ecs_id_t entity_id = _ecs_id_obtain(ecs);
+        _ecs_arr_set(&archetype->entities, row + i, &entity_id);
+        _ecs_arr_set(&ecs->records, _ecs_id_idx(entity_id), &(_ecs_entity_t){.archetype = archetype, .row = row + i});
+    }
+    archetype->entities.len += count;
+
+    if (entities)
+        memcpy(entities, _ecs_arr_get(&archetype->entities, row), count * sizeof *entities);
+
+    // Every column gets one block copy (or clear) per chunk. Columns that weren't listed are zeroed.
+    _ecs_arr_foreach(_ecs_column_t const *column, archetype->layout, {
+        void const *data = NULL;
+        for (size_t i = 0; component_data && i < component_count && !data; i++)
+            if (component_ids[i] == column->id)
+                data = component_data[i];
+
+        _ecs_archetype_fill(archetype, column, row, count, data);
+    });
+    _ecs_archetype_touch(archetype, NULL, row, count, ecs->tick, 1);
+}
+
+// The node at `idx`, if the entity was ever in a hierarchy
+static _ecs_node_t *_ecs_node_get(ecs_t const *ecs, uint32_t idx) {
+    return idx < ecs->nodes.len ? _ecs_arr_get(&ecs->nodes, idx) : NULL;
+}
+
+// Same, but grows `nodes` up to `idx` with detached nodes
+static _ecs_node_t *_ecs_node_obtain(ecs_t *ecs, uint32_t idx) {
+    _ecs_arr_reserve(&ecs->nodes, idx + 1);
+    while (ecs->nodes.len <= idx)
+        _ecs_arr_push(&ecs->nodes, &(_ecs_node_t){_ecs_no_node, _ecs_no_node, _ecs_no_node, _ecs_no_node});
+    return _ecs_arr_get(&ecs->nodes, idx);
+}
+
+// Takes the node at `idx` out of its parent's children
+static void _ecs_node_unlink(ecs_t *ecs, uint32_t idx) {
+    _ecs_node_t *node = _ecs_node_get(ecs, idx);
+    if (!node || node->parent == _ecs_no_node) return;
+
+    if (node->prev != _ecs_no_node)
+        _ecs_node_get(ecs, node->prev)->next = node->next;
+    else
+        _ecs_node_get(ecs, node->parent)->first_child = node->next;
+    if (node->next != _ecs_no_node)
+        _ecs_node_get(ecs, node->next)->prev = node->prev;
+
+    node->parent = node->next = node->prev = _ecs_no_node;
+}
+
+// Despawns every descendant of the node at `idx`, whose entity is already gone or about to be
+static void _ecs_node_despawn_children(ecs_t *ecs, uint32_t idx) {
+    _ecs_node_t *node = _ecs_node_get(ecs, idx);
+    if (!node || node->first_child == _ecs_no_node) return;
+
+    // Subtrees can be as deep as they like, so walk them with a stack of our own
+    _ecs_arr_t stack = _ecs_arr_make(NULL, sizeof (uint32_t), 0);
+    _ecs_arr_push(&stack, &idx);
+
+    while (stack.len) {
+        node = _ecs_node_get(ecs, _ecs_arr_pop_as(&stack, uint32_t));
+        for (uint32_t child = node->first_child, next; child != _ecs_no_node; child = next) {
+            _ecs_node_t *child_node = _ecs_node_get(ecs, child);
+            next = child_node->next;
+            child_node->parent = child_node->next = child_node->prev = _ecs_no_node;
+
+            _ecs_entity_t *entity = _ecs_arr_get(&ecs->records, child);
+            _ecs_archetype_remove(ecs, entity->archetype, entity->row);
+            _ecs_id_release(ecs, _ecs_arr_get_as(&ecs->ids, child, ecs_id_t));
+            _ecs_arr_push(&stack, &child);
+        }
+        node->first_child = _ecs_no_node;
+    }
+
+    _ecs_arr_free(&stack);
+}
+
+void ecs_despawn(ecs_t *ecs, ecs_id_t entity_id) {
+    _ecs_entity_t *entity = _ecs_entity_get(ecs, entity_id);
+    if (!entity) return;
+
+    _ecs_archetype_remove(ecs, entity->archetype, entity->row);
+    _ecs_id_release(ecs, entity_id);
+
+    _ecs_node_unlink(ecs, _ecs_id_idx(entity_id));
+    _ecs_node_despawn_children(ecs, _ecs_id_idx(entity_id));
+}
+
+void _ecs_set(ecs_t *ecs, ecs_id_t entity_id, char const *component_name, size_t component_stride, void const *data) {
+    ecs_set_id(ecs, entity_id, _ecs_component(ecs, component_name, component_stride), data);
+}
+
+void *_ecs_get(ecs_t *ecs, ecs_id_t entity_id, char const *component_name) {
+    return ecs_get_id(ecs, entity_id, _ecs_str_hash(component_name, 0));
+}
+
+void _ecs_rem(ecs_t *ecs, ecs_id_t entity_id, char const *component_name) {
+    ecs_rem_id(ecs, entity_id, _ecs_str_hash(component_name, 0));
+}
+
+void ecs_set_id(ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id, void const *data) {
+    _ecs_entity_t *entity = _ecs_entity_get(ecs, entity_id);
+    if (!entity) return;
+
+    // Already has the component, overwrite it in place
+    _ecs_column_t *column = _ecs_archetype_column(entity->archetype, component_id);
+    if (column) {
+        if (data) _ecs_archetype_write(ecs, entity->archetype, column, entity->row, data);
+        return;
+    }
+
+    ecs_set_many(ecs, entity_id, 1, &component_id, &data);
+}
+
+void *ecs_get_id(ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id) {
+    _ecs_entity_t *entity = _ecs_entity_get(ecs, entity_id);
+    if (!entity) return NULL;
+
+    _ecs_column_t *column = _ecs_archetype_column(entity->archetype, component_id);
+    return column ? _ecs_archetype_cell(entity->archetype, column, entity->row) : NULL;
+}
+
+void ecs_rem_id(ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id) {
+    ecs_rem_many(ecs, entity_id, 1, &component_id);
+}
+
+int _ecs_has(ecs_t *ecs, ecs_id_t entity_id, char const *component_name) {
+    return ecs_has_id(ecs, entity_id, _ecs_str_hash(component_name, 0));
+}
+
+int ecs_has_id(ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id) {
+    _ecs_entity_t *entity = _ecs_entity_get(ecs, entity_id);
+    return entity && _ecs_archetype_has(ecs, entity->archetype, component_id);
+}
+
+void ecs_set_many(ecs_t *ecs, ecs_id_t entity_id, size_t component_count, ecs_id_t const *component_ids, void const *const *data) {
+    _ecs_entity_t *entity = _ecs_entity_get(ecs, entity_id);
+    if (!entity) return;
+
+    _ecs_archetype_t *curr = entity->archetype;
+    _ecs_archetype_t *archetype = _ecs_archetype_obtain(ecs, curr, component_count, component_ids, 1);
+
+    if (archetype != curr) {
+        entity->archetype = archetype;
+        entity->row = _ecs_archetype_transfer(ecs, curr, archetype, entity->row);
+    }
+
+    for (size_t i = 0; data && i < component_count; i++) {
+        _ecs_column_t *column = _ecs_archetype_column(archetype, component_ids[i]);
+        if (column && data[i])
+            _ecs_archetype_write(ecs, archetype, column, entity->row, data[i]);
+    }
+}
+
+void ecs_rem_many(ecs_t *ecs, ecs_id_t entity_id, size_t component_count, ecs_id_t const *component_ids) {
+    _ecs_entity_t *entity = _ecs_entity_get(ecs, entity_id);
+    if (!entity) return;
+
+    _ecs_archetype_t *curr = entity->archetype;
+    _ecs_archetype_t *next = _ecs_archetype_obtain(ecs, curr, component_count, component_ids, 0);
+    if (next == curr) return;
+
+    entity->archetype = next;
+    entity->row = _ecs_archetype_transfer(ecs, curr, next, entity->row);
+}
+
+// Moves the entity at `idx` and its descendants, parents first, to the depth below their parent's
+static void _ecs_node_settle(ecs_t *ecs, uint32_t idx) {
+    _ecs_arr_t stack = _ecs_arr_make(NULL, sizeof (uint32_t), 0);
+    _ecs_arr_push(&stack, &idx);
+
+    while (stack.len) {
+        uint32_t at = _ecs_arr_pop_as(&stack, uint32_t);
+        _ecs_node_t const *node = _ecs_node_get(ecs, at);
+        _ecs_entity_t *entity = _ecs_arr_get(&ecs->records, at);
+
+        uint32_t depth = 0;
+        if (node->parent != _ecs_no_node)
+            depth = _ecs_arr_get_as(&ecs->records, node->parent, _ecs_entity_t).archetype->depth + 1;
+
+        // Once an entity already sits at the right depth, so does everything under it
+        if (entity->archetype->depth == depth) continue;
+
+        _ecs_archetype_t *next = _ecs_archetype_at_depth(ecs, entity->archetype, depth);
+        if (next != entity->archetype) {
+            entity->row = _ecs_archetype_transfer(ecs, entity->archetype, next, entity->row);
+            entity->archetype = next;
+        }
+
+        for (uint32_t child = node->first_child; child != _ecs_no_node; child = _ecs_node_get(ecs, child)->next)
+            _ecs_arr_push(&stack, &child);
+    }
+
+    _ecs_arr_free(&stack);
+}
+
+void ecs_set_parent(ecs_t *ecs, ecs_id_t entity_id, ecs_id_t parent_id) {
+    if (!_ecs_entity_get(ecs, entity_id)) return;
+    uint32_t idx = _ecs_id_idx(entity_id), parent = _ecs_no_node;
+
+    if (parent_id != ECS_NONE) {
+        if (!_ecs_entity_get(ecs, parent_id)) return;
+        parent = _ecs_id_idx(parent_id);
+
+        // Refuse cycles: the new parent can't be the entity or sit under it
+        for (uint32_t up = parent; up != _ecs_no_node;) {
+            if (up == idx) return;
+            _ecs_node_t const *node = _ecs_node_get(ecs, up);
+            up = node ? node->parent : _ecs_no_node;
+        }
+    }
+
+    _ecs_node_t *node = _ecs_node_get(ecs, idx);
+    if (node ? node->parent == parent : parent == _ecs_no_node) return;
+
+    _ecs_node_obtain(ecs, parent != _ecs_no_node && parent > idx ? parent : idx);
+    _ecs_node_unlink(ecs, idx);
+
+    if (parent != _ecs_no_node) {
+        node = _ecs_node_get(ecs, idx);
+        _ecs_node_t *parent_node = _ecs_node_get(ecs, parent);
+
+        node->parent = parent;
+        node->next = parent_node->first_child;
+        if (node->next != _ecs_no_node)
+            _ecs_node_get(ecs, node->next)->prev = idx;
+        parent_node->first_child = idx;
+    }
+
+    _ecs_node_settle(ecs, idx);
+}
+
+// The entity at the node index `idx`, or ECS_NONE
+static ecs_id_t _ecs_node_entity(ecs_t const *ecs, uint32_t idx) {
+    return idx == _ecs_no_node ? ECS_NONE : _ecs_arr_get_as(&ecs->ids, idx, ecs_id_t);
+}
+
+ecs_id_t ecs_parent(ecs_t const *ecs, ecs_id_t entity_id) {
+    _ecs_node_t const *node = _ecs_entity_get(ecs, entity_id) ? _ecs_node_get(ecs, _ecs_id_idx(entity_id)) : NULL;
+    return node ? _ecs_node_entity(ecs, node->parent) : ECS_NONE;
+}
+
+ecs_id_t ecs_first_child(ecs_t const *ecs, ecs_id_t entity_id) {
+    _ecs_node_t const *node = _ecs_entity_get(ecs, entity_id) ? _ecs_node_get(ecs, _ecs_id_idx(entity_id)) : NULL;
+    return node ? _ecs_node_entity(ecs, node->first_child) : ECS_NONE;
+}
+
+ecs_id_t ecs_next_sibling(ecs_t const *ecs, ecs_id_t entity_id) {
+    _ecs_node_t const *node = _ecs_entity_get(ecs, entity_id) ? _ecs_node_get(ecs, _ecs_id_idx(entity_id)) : NULL;
+    return node ? _ecs_node_entity(ecs, node->next) : ECS_NONE;
+}
+
+uint32_t ecs_depth(ecs_t const *ecs, ecs_id_t entity_id) {
+    _ecs_entity_t const *entity = _ecs_entity_get(ecs, entity_id);
+    return entity ? entity->archetype->depth : 0;
+}
+
+// Stamps the columns `system` writes in the chunk, before it runs on it
+static void _ecs_chunk_touch(ecs_t *ecs, _ecs_system_t const *system, _ecs_chunk_t *chunk) {
+    _ecs_arr_foreach(ecs_id_t const *component_id, system->writes, {
+        ptrdiff_t index = _ecs_map_index(&chunk->archetype->columns, *component_id);
+        if (index >= 0) chunk->changed[index] = ecs->tick;
+    });
+}
+
+// Whether `chunk` passes the ecs_run_since filter
+static int _ecs_chunk_since(_ecs_chunk_t const *chunk, ecs_id_t component_id, int filter, uint32_t since) {
+    if (!filter) return 1;
+
+    ptrdiff_t index = _ecs_map_index(&chunk->archetype->columns, component_id);
+    if (index < 0) return 0;
+
+    return (filter == ECS_ADDED ? chunk->added[index] : chunk->changed[index]) > since;
+}
+
+static void _ecs_run(ecs_t *ecs, ecs_id_t system_id, ecs_id_t component_id, int filter, uint32_t since) {
+    if (system_id >= ecs->systems.len) return;
+    _ecs_stat(uint64_t start = _ecs_clock_ns());
+    _ecs_stat(size_t visited = 0);
+
+    _ecs_system_t *system = _ecs_arr_get(&ecs->systems, system_id);
+    _ecs_arr_foreach(_ecs_archetype_t **it, system->archetypes, {
+        _ecs_archetype_t *archetype = *it;
+
+        for (size_t begin = 0, i = 0; begin < archetype->entities.len; begin += archetype->chunk_cap, i++) {
+            _ecs_chunk_t *chunk = _ecs_arr_get(&archetype->chunks, i);
+            if (!_ecs_chunk_since(chunk, component_id, filter, since)) continue;
+
+            _ecs_chunk_touch(ecs, system, chunk);
+
+            size_t count = archetype->entities.len - begin;
+            _ecs_task_exec(&(_ecs_task_t){
+                .kind       = _ECS_TASK_ROWS,
+                .fn         = system->fn,
+                .range_fn   = system->range_fn,
+                .components = chunk,
+                .entities   = _ecs_arr_get(&archetype->entities, begin),
+                .count      = count < archetype->chunk_cap ? count : archetype->chunk_cap,
+            });
+            _ecs_stat(visited += count < archetype->chunk_cap ? count : archetype->chunk_cap);
+        }
+    });
+
+    _ecs_stat(_ecs_stats_record(ecs, system_id, start, _ecs_clock_ns(), visited));
+}
+
+void ecs_run(ecs_t *ecs, ecs_id_t system_id) {
+    _ecs_run(ecs, system_id, 0, 0, 0);
+}
+
+void ecs_run_since(ecs_t *ecs, ecs_id_t system_id, ecs_id_t component_id, int filter, uint32_t since) {
+    _ecs_run(ecs, system_id, component_id, filter, since);
+}
+
+// Starts the thread pool if needed, along with a command buffer for each of its threads
+static _ecs_pool_t *_ecs_pool_obtain(ecs_t *ecs) {
+    if (ecs->pool) return ecs->pool;
+
+    ecs->pool = _ecs_pool_make(ecs->thread_count);
+    while (ecs->cmdbufs.len <= (size_t)ecs->pool->count)
+        _ecs_arr_push(&ecs->cmdbufs, &(_ecs_cmdbuf_t){_ecs_arr_make(NULL, sizeof (_ecs_cmd_t), 0), _ecs_arr_make(NULL, 1, 0)});
+
+    return ecs->pool;
+}
+
+void ecs_run_parallel(ecs_t *ecs, ecs_id_t system_id, size_t grain) {
+    if (system_id >= ecs->systems.len) return;
+    if (!grain) grain = 1024;
+    _ecs_pool_obtain(ecs);
+
+    // Split every chunk of the matching archetypes into `grain`-row ranges, or keep it whole when the system can't
+    // take a range
+    _ecs_system_t *system = _ecs_arr_get(&ecs->systems, system_id);
+    _ecs_arr_t tasks = _ecs_arr_make(NULL, sizeof (_ecs_task_t), 0);
+
+    _ecs_arr_foreach(_ecs_archetype_t **it, system->archetypes, {
+        _ecs_archetype_t *archetype = *it;
+
+        for (size_t first = 0, i = 0; first < archetype->entities.len; first += archetype->chunk_cap, i++) {
+            size_t rows = archetype->entities.len - first;
+            if (rows > archetype->chunk_cap) rows = archetype->chunk_cap;
+
+            _ecs_chunk_touch(ecs, system, _ecs_arr_get(&archetype->chunks, i));
+
+            size_t step = system->range_fn ? grain : rows;
+            for (size_t begin = 0; begin < rows; begin += step) {
+                _ecs_arr_push(&tasks, &(_ecs_task_t){
+                    .kind       = _ECS_TASK_ROWS,
+                    .fn         = system->fn,
+                    .range_fn   = system->range_fn,
+                    .ecs        = ecs,
+                    .system_id  = system_id,
+                    .components = _ecs_arr_get(&archetype->chunks, i),
+                    .entities   = _ecs_arr_get(&archetype->entities, first),
+                    .begin      = begin,
+                    .count      = rows - begin < step ? rows - begin : step,
+                });
+            }
+        }
+    });
+
+    _ecs_pool_submit(ecs->pool, (_ecs_task_t *)tasks.data, tasks.len);
+    _ecs_arr_free(&tasks);
+}
+
+static int _ecs_arr_contains(_ecs_arr_t const *a, ecs_id_t id) {
+    _ecs_arr_foreach(ecs_id_t const *x, *a, {
+        if (*x == id) return 1;
+    });
+    return 0;
+}
+
+// Whether `a` writes something `b` touches or the other way around
+static int _ecs_system_conflicts(_ecs_system_t const *a, _ecs_system_t const *b) {
+    _ecs_arr_foreach(ecs_id_t const *component_id, a->writes, {
+        if (_ecs_arr_contains(&b->components, *component_id)) return 1;
+    });
+    _ecs_arr_foreach(ecs_id_t const *component_id, b->writes, {
+        if (_ecs_arr_contains(&a->components, *component_id)) return 1;
+    });
+    return 0;
+}
+
+// Links every system to the later ones it conflicts with, so they wait for it
+static void _ecs_schedule_build(ecs_t *ecs) {
+    for (size_t i = 0; i < ecs->systems.len; i++) {
+        _ecs_system_t *system = _ecs_arr_get(&ecs->systems, i);
+        system->dependents.len = 0;
+        system->dependencies = 0;
+    }
+
+    for (size_t j = 0; j < ecs->systems.len; j++) {
+        _ecs_system_t *later = _ecs_arr_get(&ecs->systems, j);
+        for (size_t i = 0; i < j; i++) {
+            _ecs_system_t *earlier = _ecs_arr_get(&ecs->systems, i);
+            if (!_ecs_system_conflicts(earlier, later)) continue;
+
+            _ecs_arr_push(&earlier->dependents, &j);
+            later->dependencies++;
+        }
+    }
+
+    ecs->schedule_dirty = 0;
+}
+
+// Runs an _ECS_TASK_SYSTEM task for ecs_run_all. Once the system is done, the dependents it was the last one holding
+// back are queued.
+static void _ecs_schedule_exec(ecs_t *ecs, size_t system_id) {
+    ecs_run(ecs, system_id);
+
+    _ecs_system_t *system = _ecs_arr_get(&ecs->systems, system_id);
+    _ecs_arr_foreach(size_t const *dependent_id, system->dependents, {
+        _ecs_system_t *dependent = _ecs_arr_get(&ecs->systems, *dependent_id);
+        if (_ecs_atomic_sub(&dependent->waiting, 1) == 1)
+            _ecs_pool_submit(ecs->pool, &(_ecs_task_t){.kind = _ECS_TASK_SYSTEM, .ecs = ecs, .system_id = *dependent_id}, 1);
+    });
+}
+
+void ecs_run_all(ecs_t *ecs) {
+    if (!ecs->systems.len) return;
+    _ecs_pool_obtain(ecs);
+    if (ecs->schedule_dirty) _ecs_schedule_build(ecs);
+
+    _ecs_arr_t tasks = _ecs_arr_make(NULL, sizeof (_ecs_task_t), 0);
+    for (size_t i = 0; i < ecs->systems.len; i++) {
+        _ecs_system_t *system = _ecs_arr_get(&ecs->systems, i);
+        _ecs_atomic_store(&system->waiting, system->dependencies);
+        if (!system->dependencies)
+            _ecs_arr_push(&tasks, &(_ecs_task_t){.kind = _ECS_TASK_SYSTEM, .ecs = ecs, .system_id = i});
+    }
+
+    _ecs_pool_submit(ecs->pool, (_ecs_task_t *)tasks.data, tasks.len);
+    _ecs_arr_free(&tasks);
+    _ecs_pool_join(ecs->pool);
+    ecs_flush(ecs);
+}
+
+void ecs_join(ecs_t *ecs) {
+    if (ecs->pool)
+        _ecs_pool_join(ecs->pool);
+    ecs_flush(ecs);
+}
+
+void ecs_threads(ecs_t *ecs, int thread_count) {
+    if (ecs->pool)
+        _ecs_pool_free(ecs->pool);
+
+    ecs->pool = NULL;
+    ecs->thread_count = thread_count;
+}
+
+// The calling thread's buffer. Anything that isn't one of the pool's threads records into buffer 0.
+static _ecs_cmdbuf_t *_ecs_cmdbuf_get(ecs_t *ecs) {
+    return _ecs_arr_get(&ecs->cmdbufs, (size_t)_ecs_pool_slot(ecs->pool));
+}
+
+static void _ecs_cmd_push(ecs_t *ecs, int op, ecs_id_t entity_id, ecs_id_t component_id, size_t stride, void const *data) {
+    _ecs_cmdbuf_t *buf = _ecs_cmdbuf_get(ecs);
+    _ecs_cmd_t cmd = {op, entity_id, component_id, stride, SIZE_MAX};
+
+    if (data) {
+        cmd.offset = buf->data.len;
+        _ecs_arr_reserve(&buf->data, buf->data.len + stride);
+        memcpy(_ecs_arr_get(&buf->data, cmd.offset), data, stride);
+        buf->data.len += stride;
+    }
+
+    _ecs_arr_push(&buf->cmds, &cmd);
+}
+
+ecs_id_t ecs_cmd_spawn(ecs_t *ecs) {
+    // Nothing may touch `ids` while systems run, so hand out the indices past its end. ecs_flush gives them slots.
+    ecs_id_t entity_id = ecs->ids.len + _ecs_atomic_add(&ecs->reserved, 1);
+    _ecs_cmd_push(ecs, _ECS_CMD_SPAWN, entity_id, 0, 0, NULL);
+    return entity_id;
+}
+
+void ecs_cmd_despawn(ecs_t *ecs, ecs_id_t entity_id) {
+    _ecs_cmd_push(ecs, _ECS_CMD_DESPAWN, entity_id, 0, 0, NULL);
+}
+
+// The stride is recorded with the command, so ecs_flush can register the component if this is its first use
+void _ecs_cmd_set(ecs_t *ecs, ecs_id_t entity_id, char const *component_name, size_t component_stride, void const *data) {
+    _ecs_cmd_push(ecs, _ECS_CMD_SET, entity_id, _ecs_str_hash(component_name, 0), component_stride, data);
+}
+
+void _ecs_cmd_rem(ecs_t *ecs, ecs_id_t entity_id, char const *component_name) {
+    ecs_cmd_rem_id(ecs, entity_id, _ecs_str_hash(component_name, 0));
+}
+
+void ecs_cmd_set_id(ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id, void const *data) {
+    size_t *stride = _ecs_map_get(&ecs->components, component_id);
+    if (stride)
+        _ecs_cmd_push(ecs, _ECS_CMD_SET, entity_id, component_id, *stride, data);
+}
+
+void ecs_cmd_rem_id(ecs_t *ecs, ecs_id_t entity_id, ecs_id_t component_id) {
+    _ecs_cmd_push(ecs, _ECS_CMD_REM, entity_id, component_id, 0, NULL);
+}
+
+// The move of `entity_id`, started at its current archetype the first time the entity is seen.
+// NULL if the entity is dead.
+static _ecs_move_t *_ecs_move_get(ecs_t *ecs, _ecs_map_t *seen, _ecs_arr_t *moves, ecs_id_t entity_id) {
+    size_t *i = _ecs_map_get(seen, entity_id);
+    if (i) return _ecs_arr_get(moves, *i);
+
+    _ecs_entity_t *entity = _ecs_record_get(ecs, entity_id);
+    if (!entity) return NULL;
+
+    // Spawned entities have no archetype yet and start from the root, like ecs_spawn
+    _ecs_archetype_t *dst = entity->archetype ? entity->archetype : ecs->root;
+    size_t index = _ecs_arr_push(moves, &(_ecs_move_t){entity_id, entity->archetype, dst, .len = dst->components.len});
+    _ecs_map_set(seen, entity_id, &index);
+
+    return _ecs_arr_get(moves, index);
+}
+
+static int _ecs_move_cmp(void const *a, void const *b) {
+    _ecs_move_t const *x = a, *y = b;
+    if (x->src != y->src) return (uintptr_t)x->src < (uintptr_t)y->src ? -1 : 1;
+    if (x->dst != y->dst) return (uintptr_t)x->dst < (uintptr_t)y->dst ? -1 : 1;
+    return 0;
+}
+
+// Applies the moves from `src` to `dst` in moves[begin, end). Rows and entity slots are reserved once per group.
+static void _ecs_move_apply(ecs_t *ecs, _ecs_move_t const *moves, size_t begin, size_t end) {
+    _ecs_archetype_t *src = moves[begin].src, *dst = moves[begin].dst;
+    if (src == dst && dst) return;
+
+    if (!dst) {
+        for (size_t i = begin; i < end; i++) {
+            _ecs_entity_t *entity = _ecs_arr_get(&ecs->records, _ecs_id_idx(moves[i].entity_id));
+            if (src) _ecs_archetype_remove(ecs, src, entity->row);
+            _ecs_id_release(ecs, moves[i].entity_id);
+        }
+        return;
+    }
+
+    size_t row = dst->entities.len;
+    _ecs_arr_reserve(&dst->entities, row + end - begin);
+    _ecs_archetype_reserve(ecs, dst, row + end - begin);
+
+    for (size_t i = begin; i < end; i++) {
+        _ecs_entity_t *entity = _ecs_arr_get(&ecs->records, _ecs_id_idx(moves[i].entity_id));
+        entity->archetype = dst;
+
+        if (src)
+            entity->row = _ecs_archetype_transfer(ecs, src, dst, entity->row);
+        else
+            entity->row = _ecs_arr_push(&dst->entities, &moves[i].entity_id);
+    }
+
+    // New entities are appended together, so their columns are zeroed a block at a time
+    if (!src) {
+        _ecs_arr_foreach(_ecs_column_t const *column, dst->layout, {
+            _ecs_archetype_fill(dst, column, row, end - begin, NULL);
+        });
+        _ecs_archetype_touch(dst, NULL, row, end - begin, ecs->tick, 1);
+    }
+}
+
+void ecs_flush(ecs_t *ecs) {
+    size_t pending = _ecs_atomic_load(&ecs->reserved);
+    _ecs_arr_foreach(_ecs_cmdbuf_t *buf, ecs->cmdbufs, {
+        pending += buf->cmds.len;
+    });
+    if (!pending) return;
+
+    _ecs_id_claim(ecs);
+
+    // Work out where every entity ends up, without moving anything yet. The commands are applied to a sorted
+    // component list per entity and only the final list is looked up, so no intermediate archetype gets created.
+    _ecs_map_t seen = _ecs_map_make(NULL, sizeof (size_t), 0);
+    _ecs_arr_t moves = _ecs_arr_make(NULL, sizeof (_ecs_move_t), 0);
+
+    _ecs_arr_foreach(_ecs_cmdbuf_t *buf, ecs->cmdbufs, {
+        _ecs_arr_foreach(_ecs_cmd_t const *cmd, buf->cmds, {
+            _ecs_move_t *move = _ecs_move_get(ecs, &seen, &moves, cmd->entity_id);
+            if (!move || !move->dst) continue;
+
+            if (cmd->op == _ECS_CMD_DESPAWN)
+                move->dst = NULL;
+            if (cmd->op != _ECS_CMD_SET) continue;
+
+            _ecs_component_define(ecs, cmd->component_id, cmd->stride);
+            move->sets++;
+        });
+    });
+
+    size_t total = 0;
+    _ecs_arr_foreach(_ecs_move_t *move, moves, {
+        if (!move->dst) continue;
+        move->ids = total;
+        total += move->len + move->sets;
+    });
+
+    _ecs_arr_t scratch = _ecs_arr_make(NULL, sizeof (ecs_id_t), total);
+    _ecs_arr_foreach(_ecs_move_t *move, moves, {
+        if (move->dst) memcpy((ecs_id_t *)scratch.data + move->ids, move->dst->components.data, move->len * sizeof (ecs_id_t));
+    });
+
+    _ecs_arr_foreach(_ecs_cmdbuf_t *buf, ecs->cmdbufs, {
+        _ecs_arr_foreach(_ecs_cmd_t const *cmd, buf->cmds, {
+            size_t *index = _ecs_map_get(&seen, cmd->entity_id);
+            _ecs_move_t *move = index ? _ecs_arr_get(&moves, *index) : NULL;
+            if (!move || !move->dst || cmd->op == _ECS_CMD_DESPAWN) continue;
+
+            ecs_id_t *ids = (ecs_id_t *)scratch.data + move->ids;
+            size_t at = 0;
+            while (at < move->len && ids[at] < cmd->component_id) at++;
+            int present = at < move->len && ids[at] == cmd->component_id;
+
+            if (cmd->op == _ECS_CMD_SET && !present) {
+                memmove(&ids[at + 1], &ids[at], (move->len - at) * sizeof *ids);
+                ids[at] = cmd->component_id;
+                move->len++;
+            } else if (cmd->op == _ECS_CMD_REM && present) {
+                memmove(&ids[at], &ids[at + 1], (move->len - at - 1) * sizeof *ids);
+                move->len--;
+            }
+        });
+    });
+
+    _ecs_arr_foreach(_ecs_move_t *move, moves, {
+        _ecs_archetype_t *curr = move->dst;
+        ecs_id_t const *ids = (ecs_id_t const *)scratch.data + move->ids;
+        if (!curr || (move->len == curr->components.len && !memcmp(ids, curr->components.data, move->len * sizeof *ids)))
+            continue;
+
+        move->dst = _ecs_archetype_find(ecs, ids, move->len, curr->depth);
+        if (!move->dst) move->dst = _ecs_archetype_make(ecs, ids, move->len, curr->depth);
+    });
+    _ecs_arr_free(&scratch);
+
+    // Move the entities one (src, dst) group at a time
+    qsort(moves.data, moves.len, moves.stride, _ecs_move_cmp);
+    _ecs_move_t const *all = (_ecs_move_t const *)moves.data;
+    for (size_t i = 0, j; i < moves.len; i = j) {
+        for (j = i + 1; j < moves.len && !_ecs_move_cmp(&all[i], &all[j]); j++);
+        _ecs_move_apply(ecs, all, i, j);
+    }
+
+    // Despawned entities take their descendants with them. Every one of them leaves its parent first, so that none is
+    // found again as the child of another
+    for (size_t i = 0; ecs->nodes.len && i < moves.len; i++)
+        if (!all[i].dst) _ecs_node_unlink(ecs, _ecs_id_idx(all[i].entity_id));
+    for (size_t i = 0; ecs->nodes.len && i < moves.len; i++)
+        if (!all[i].dst) _ecs_node_despawn_children(ecs, _ecs_id_idx(all[i].entity_id));
+
+    // Now every entity is in its final archetype, write the values in the order they were recorded
+    _ecs_arr_foreach(_ecs_cmdbuf_t *buf, ecs->cmdbufs, {
+        _ecs_arr_foreach(_ecs_cmd_t const *cmd, buf->cmds, {
+            if (cmd->op != _ECS_CMD_SET || cmd->offset == SIZE_MAX) continue;
+
+            _ecs_entity_t *entity = _ecs_entity_get(ecs, cmd->entity_id);
+            _ecs_column_t *column = entity ? _ecs_archetype_column(entity->archetype, cmd->component_id) : NULL;
+            if (column)
+                _ecs_archetype_write(ecs, entity->archetype, column, entity->row, _ecs_arr_get(&buf->data, cmd->offset));
+        });
+
+        buf->cmds.len = buf->data.len = 0;
+    });
+
+    _ecs_map_free(&seen);
+    _ecs_arr_free(&moves);
+}
+
+uint32_t ecs_tick(ecs_t const *ecs) {
+    return ecs->tick;
+}
+
+uint32_t ecs_advance(ecs_t *ecs) {
+    return ++ecs->tick;
+}
 
 void *_ecs_field(void const *components, char const *component_name) {
-    _ecs_arr_t *arr = _ecs_map_get(components, _ecs_str_hash(component_name, 0));
-    return arr ? arr->data : NULL;
+    return ecs_field_id(components, _ecs_str_hash(component_name, 0));
+}
+
+void *ecs_field_id(void const *components, ecs_id_t component_id) {
+    _ecs_chunk_t const *chunk = components;
+    _ecs_column_t const *column = _ecs_archetype_column(chunk->archetype, component_id);
+    return column ? chunk->data + column->offset : NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Bulk operations
+
+// Floats per ECS_ALIGN block. Every loop below runs over whole blocks with aligned accesses.
+#define _ecs_block_f32      (ECS_ALIGN / sizeof (float))
+#define _ecs_blocks_f32(n)  (((n) + _ecs_block_f32 - 1) / _ecs_block_f32 * _ecs_block_f32)
+
+void ecs_fill_f32(float *dst, float value, size_t count) {
+    dst = _ecs_assume_aligned(dst);
+    size_t n = _ecs_blocks_f32(count);
+#if defined(__AVX__)
+    __m256 v = _mm256_set1_ps(value);
+    for (size_t i = 0; i < n; i += 8)
+        _mm256_store_ps(dst + i, v);
+#elif defined(__SSE2__)
+    __m128 v = _mm_set1_ps(value);
+    for (size_t i = 0; i < n; i += 4)
+        _mm_store_ps(dst + i, v);
+#else
+    for (size_t i = 0; i < n; i++)
+        dst[i] = value;
+#endif
+}
+
+void ecs_copy_f32(float *dst, float const *src, size_t count) {
+    dst = _ecs_assume_aligned(dst);
+    src = _ecs_assume_aligned(src);
+    size_t n = _ecs_blocks_f32(count);
+#if defined(__AVX__)
+    for (size_t i = 0; i < n; i += 8)
+        _mm256_store_ps(dst + i, _mm256_load_ps(src + i));
+#elif defined(__SSE2__)
+    for (size_t i = 0; i < n; i += 4)
+        _mm_store_ps(dst + i, _mm_load_ps(src + i));
+#else
+    for (size_t i = 0; i < n; i++)
+        dst[i] = src[i];
+#endif
+}
+
+// No fused multiply-add, so every path rounds like the scalar one
+void ecs_axpy_f32(float *dst, float const *src, float scale, size_t count) {
+    dst = _ecs_assume_aligned(dst);
+    src = _ecs_assume_aligned(src);
+    size_t n = _ecs_blocks_f32(count);
+#if defined(__AVX__)
+    __m256 k = _mm256_set1_ps(scale);
+    for (size_t i = 0; i < n; i += 8)
+        _mm256_store_ps(dst + i, _mm256_add_ps(_mm256_load_ps(dst + i), _mm256_mul_ps(k, _mm256_load_ps(src + i))));
+#elif defined(__SSE2__)
+    __m128 k = _mm_set1_ps(scale);
+    for (size_t i = 0; i < n; i += 4)
+        _mm_store_ps(dst + i, _mm_add_ps(_mm_load_ps(dst + i), _mm_mul_ps(k, _mm_load_ps(src + i))));
+#else
+    for (size_t i = 0; i < n; i++)
+        dst[i] += scale * src[i];
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Compaction
+
+size_t ecs_compact_step(ecs_t *ecs, size_t budget) {
+    _ecs_archetype_t **archetypes = (_ecs_archetype_t **)ecs->archetypes.data;
+    size_t begin = ecs->compact_next, end = begin, kept = begin;
+
+    // Unlink the empty archetypes in [begin, end) and slide the others down, so creation order is kept
+    _ecs_arr_t freed = _ecs_arr_make(NULL, sizeof (_ecs_archetype_t *), 0);
+    for (; end < ecs->archetypes.len && end - begin < budget; end++) {
+        _ecs_archetype_t *archetype = archetypes[end];
+        if (archetype->entities.len || archetype == ecs->root) {
+            _ecs_archetype_shrink(ecs, archetype);
+            _ecs_map_shrink(&archetype->edges);
+            archetypes[kept++] = archetype;
+            continue;
+        }
+
+        _ecs_archetype_unlink(ecs, archetype);
+        archetype->freed = 1;
+        _ecs_arr_push(&freed, &archetype);
+    }
+
+    memmove(&archetypes[kept], &archetypes[end], (ecs->archetypes.len - end) * sizeof *archetypes);
+    ecs->archetypes.len -= end - kept;
+    ecs->compact_next = kept;
+
+    if (freed.len) {
+        _ecs_arr_foreach(_ecs_system_t *system, ecs->systems, {
+            _ecs_archetype_t **matched = (_ecs_archetype_t **)system->archetypes.data;
+            size_t len = 0;
+            for (size_t i = 0; i < system->archetypes.len; i++)
+                if (!matched[i]->freed)
+                    matched[len++] = matched[i];
+            system->archetypes.len = len;
+            _ecs_arr_shrink(&system->archetypes);
+        });
+
+        _ecs_arr_foreach(_ecs_archetype_t **archetype, freed, {
+            _ecs_archetype_free(ecs, *archetype);
+        });
+    }
+    _ecs_arr_free(&freed);
+
+    // Went through every archetype: the rest only needs doing once per pass
+    if (ecs->compact_next == ecs->archetypes.len) {
+        ecs->compact_next = 0;
+        _ecs_chunk_drain(ecs);
+        _ecs_map_shrink(&ecs->archetype_index);
+        _ecs_arr_shrink(&ecs->archetypes);
+    }
+
+    return end - kept;
+}
+
+size_t ecs_compact(ecs_t *ecs) {
+    ecs->compact_next = 0;
+    return ecs_compact_step(ecs, SIZE_MAX);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Save / Load
+
+// File layout, every block starting on a `_ecs_column_align` boundary:
+//  header, (component id, stride) pairs, ids, hierarchy nodes
+//  for each archetype: (archetype id, component count, row count, depth), component ids, entities, then one block
+//  per column
+#define _ecs_save_magic     0x61534345u     // "ECSa"
+#define _ecs_save_version   3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t component_count;
+    uint64_t archetype_count;
+    uint64_t id_count;
+    uint64_t node_count;
+    uint64_t next_idx;
+    uint64_t tick;
+} _ecs_save_header_t;
+
+static int _ecs_save_pad(FILE *f) {
+    static char const zero[_ecs_column_align];
+    long pos = ftell(f);
+    if (pos < 0) return 0;
+
+    size_t pad = _ecs_align((size_t)pos, _ecs_column_align) - (size_t)pos;
+    return fwrite(zero, 1, pad, f) == pad;
+}
+
+static int _ecs_save_write(FILE *f, void const *data, size_t size) {
+    return !size || fwrite(data, size, 1, f) == 1;
+}
+
+int ecs_save(ecs_t const *ecs, char const *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+
+    _ecs_save_header_t header = {
+        .magic              = _ecs_save_magic,
+        .version            = _ecs_save_version,
+        .component_count    = ecs->components.len,
+        .archetype_count    = ecs->archetypes.len,
+        .id_count           = ecs->ids.len,
+        .node_count         = ecs->nodes.len,
+        .next_idx           = ecs->next_idx,
+        .tick               = ecs->tick,
+    };
+    int ok = _ecs_save_write(f, &header, sizeof header);
+
+    _ecs_map_foreach(uint64_t component_id, size_t const *stride, ecs->components, {
+        ok &= _ecs_save_write(f, &(uint64_t[]){component_id, *stride}, 2 * sizeof (uint64_t));
+    });
+
+    ok &= _ecs_save_pad(f) && _ecs_save_write(f, ecs->ids.data, ecs->ids.len * sizeof (ecs_id_t)) && _ecs_save_pad(f);
+    ok &= _ecs_save_write(f, ecs->nodes.data, ecs->nodes.len * sizeof (_ecs_node_t)) && _ecs_save_pad(f);
+
+    _ecs_arr_foreach(_ecs_archetype_t *const *it, ecs->archetypes, {
+        _ecs_archetype_t const *archetype = *it;
+        size_t rows = archetype->entities.len;
+
+        ok &= _ecs_save_write(f, &(uint64_t[]){archetype->id, archetype->components.len, rows, archetype->depth}, 4 * sizeof (uint64_t));
+        ok &= _ecs_save_write(f, archetype->components.data, archetype->components.len * sizeof (ecs_id_t));
+        ok &= _ecs_save_pad(f) && _ecs_save_write(f, archetype->entities.data, rows * sizeof (ecs_id_t)) && _ecs_save_pad(f);
+
+        // Columns are written whole, one chunk's run at a time
+        _ecs_arr_foreach(_ecs_column_t const *column, archetype->layout, {
+            for (size_t row = 0; row < rows; row += archetype->chunk_cap) {
+                size_t count = rows - row < archetype->chunk_cap ? rows - row : archetype->chunk_cap;
+                ok &= _ecs_save_write(f, _ecs_archetype_cell(archetype, column, row), count * column->stride);
+            }
+            ok &= _ecs_save_pad(f);
+        });
+    });
+
+    ok &= !fclose(f);
+    return ok ? 0 : -1;
+}
+
+// Returns the next `count` items of `size` bytes and moves past them, or NULL if the file is too short
+static void *_ecs_load_take(char **at, char const *end, uint64_t count, size_t size, int aligned) {
+    char *p = *at;
+    if (aligned)
+        p += _ecs_align((size_t)(uintptr_t)p, _ecs_column_align) - (size_t)(uintptr_t)p;
+    if (p > end || (size && count > (size_t)(end - p) / size)) return NULL;
+
+    *at = p + count * size;
+    return p;
+}
+
+// Whether `idx` is _ecs_no_node or one of the `count` indices of `ids`
+static int _ecs_load_index(uint32_t idx, size_t count) {
+    return idx == _ecs_no_node || idx < count;
+}
+
+static int _ecs_load_archetype(ecs_t *ecs, char **at, char const *end, int flags) {
+    uint64_t *head = _ecs_load_take(at, end, 4, sizeof (uint64_t), 1);
+    if (!head) return 0;
+
+    uint64_t archetype_id = head[0], component_count = head[1], rows = head[2], depth = head[3];
+    ecs_id_t *component_ids = _ecs_load_take(at, end, component_count, sizeof (ecs_id_t), 0);
+    ecs_id_t *entities = _ecs_load_take(at, end, rows, sizeof (ecs_id_t), 1);
+    if (!component_ids || !entities || depth > ecs->ids.len) return 0;
+    for (size_t i = 0; i < component_count; i++)
+        if (!_ecs_map_get(&ecs->components, component_ids[i])) return 0;
+
+    // Layouts are sorted by component id, so the columns come in the order the file has them
+    _ecs_archetype_t *archetype = _ecs_archetype_obtain(ecs, ecs->root, component_count, component_ids, 1);
+    if (depth) archetype = _ecs_archetype_at_depth(ecs, archetype, (uint32_t)depth);
+    if (archetype->id != archetype_id || archetype->components.len != component_count || archetype->entities.len) return 0;
+    if (memcmp(archetype->components.data, component_ids, component_count * sizeof (ecs_id_t))) return 0;
+
+    // Every column has to fit in what is left of the file, which also keeps the sizes below from overflowing
+    _ecs_arr_foreach(_ecs_column_t const *column, archetype->layout, {
+        if (column->stride && rows > (size_t)(end - *at) / column->stride) return 0;
+    });
+
+    // Each entity must be alive in `ids` and in no other archetype
+    for (size_t i = 0; i < rows; i++) {
+        _ecs_entity_t const *record = _ecs_record_get(ecs, entities[i]);
+        if (!record || record->archetype) return 0;
+        _ecs_arr_set(&ecs->records, _ecs_id_idx(entities[i]), &(_ecs_entity_t){.archetype = archetype, .row = i});
+    }
+
+    _ecs_arr_reserve(&archetype->entities, rows);
+    memcpy(archetype->entities.data, entities, rows * sizeof (ecs_id_t));
+    archetype->entities.len = rows;
+
+    if (!rows) return 1;
+
+#if !ECS_CHUNK_SIZE
+    // The column blocks are laid out exactly like a chunk with room for `rows` rows
+    if (flags & ECS_LOAD_MMAP) {
+        char *data = _ecs_load_take(at, end, _ecs_archetype_chunk_size(archetype, rows), 1, 1);
+        if (!data) return 0;
+
+        _ecs_chunk_t chunk = _ecs_chunk_make(ecs, archetype);
+        chunk.data = data;
+        chunk.mapped = 1;
+        _ecs_arr_push(&archetype->chunks, &chunk);
+        archetype->chunk_cap = rows;
+
+        size_t offset = 0;
+        _ecs_arr_foreach(_ecs_column_t *column, archetype->layout, {
+            column->offset = offset;
+            offset += _ecs_align(column->stride * rows, _ecs_column_align);
+        });
+
+        _ecs_archetype_touch(archetype, NULL, 0, rows, ecs->tick, 1);
+        return 1;
+    }
+#endif
+    (void)flags;
+
+    _ecs_archetype_reserve(ecs, archetype, rows);
+    _ecs_arr_foreach(_ecs_column_t const *column, archetype->layout, {
+        void *data = _ecs_load_take(at, end, _ecs_align(column->stride * rows, _ecs_column_align), 1, 1);
+        if (!data) return 0;
+        _ecs_archetype_fill(archetype, column, 0, rows, data);
+    });
+
+    _ecs_archetype_touch(archetype, NULL, 0, rows, ecs->tick, 1);
+    return 1;
+}
+
+// Every link between ids has to stay inside `ids`: the hierarchy nodes, and the free list, which must only go through
+// ids that aren't alive and visit each at most once
+static int _ecs_load_links(ecs_t const *ecs) {
+    size_t count = ecs->ids.len, dead = 0;
+    _ecs_arr_foreach(_ecs_node_t const *node, ecs->nodes, {
+        if (!_ecs_load_index(node->parent, count) || !_ecs_load_index(node->first_child, count) ||
+            !_ecs_load_index(node->next, count) || !_ecs_load_index(node->prev, count)) return 0;
+    });
+
+    _ecs_arr_foreach(_ecs_entity_t const *record, ecs->records, {
+        dead += !record->archetype;
+    });
+
+    uint32_t idx = ecs->next_idx;
+    for (size_t steps = 0; idx != UINT32_MAX; steps++) {
+        if (idx >= count || steps == dead || _ecs_arr_get_as(&ecs->records, idx, _ecs_entity_t).archetype) return 0;
+        idx = (uint32_t)_ecs_id_idx(_ecs_arr_get_as(&ecs->ids, idx, ecs_id_t));
+    }
+
+    return 1;
+}
+
+ecs_t *ecs_load(char const *path, int flags) {
+    size_t size;
+    char *image = _ecs_image_load(path, &size);
+    if (!image) return NULL;
+
+    // Everything up to the archetypes is checked against the file's size before a world is made for it
+    char *at = image, *end = image + size;
+    _ecs_save_header_t const *header = _ecs_load_take(&at, end, 1, sizeof *header, 0);
+    int ok = header && header->magic == _ecs_save_magic && header->version == _ecs_save_version &&
+        header->id_count <= UINT32_MAX && header->node_count <= header->id_count && header->next_idx <= UINT32_MAX;
+
+    uint64_t *components = ok ? _ecs_load_take(&at, end, header->component_count, 2 * sizeof (uint64_t), 0) : NULL;
+    ecs_id_t *ids = ok ? _ecs_load_take(&at, end, header->id_count, sizeof (ecs_id_t), 1) : NULL;
+    _ecs_node_t *nodes = ok ? _ecs_load_take(&at, end, header->node_count, sizeof (_ecs_node_t), 1) : NULL;
+    if (!components || !ids || !nodes) {
+        _ecs_image_free(image, size);
+        return NULL;
+    }
+
+    ecs_t *ecs = ecs_create((int)header->id_count);
+    ecs->tick = (uint32_t)header->tick;
+    ecs->next_idx = (uint32_t)header->next_idx;
+
+    for (size_t i = 0; ok && i < header->component_count; i++)
+        _ecs_map_set(&ecs->components, components[i * 2], &(size_t){components[i * 2 + 1]});
+
+    _ecs_arr_reserve(&ecs->ids, header->id_count);
+    _ecs_arr_reserve(&ecs->records, header->id_count);
+    memcpy(ecs->ids.data, ids, header->id_count * sizeof (ecs_id_t));
+    memset(ecs->records.data, 0, header->id_count * sizeof (_ecs_entity_t));
+    ecs->ids.len = ecs->records.len = header->id_count;
+
+    _ecs_arr_reserve(&ecs->nodes, header->node_count);
+    memcpy(ecs->nodes.data, nodes, header->node_count * sizeof (_ecs_node_t));
+    ecs->nodes.len = header->node_count;
+
+    for (size_t i = 0; ok && i < header->archetype_count; i++)
+        ok = _ecs_load_archetype(ecs, &at, end, flags);
+    ok = ok && _ecs_load_links(ecs);
+
+    if (!ok) {
+        ecs_delete(ecs);
+        _ecs_image_free(image, size);
+        return NULL;
+    }
+
+    // Keep the image alive only if columns point into it
+    if (flags & ECS_LOAD_MMAP && !ECS_CHUNK_SIZE) {
+        ecs->mapped = image;
+        ecs->mapped_size = size;
+    } else {
+        _ecs_image_free(image, size);
+    }
+
+    return ecs;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Stats
+
+static size_t _ecs_column_bytes(_ecs_archetype_t const *archetype, _ecs_column_t const *column) {
+    return _ecs_align(column->stride * archetype->chunk_cap, _ecs_column_align) * archetype->chunks.len;
+}
+
+ecs_stats_t ecs_stats(ecs_t const *ecs) {
+    ecs_stats_t stats = {.archetypes = ecs->archetypes.len, .transfers = ecs->transfers};
+
+    _ecs_arr_foreach(_ecs_archetype_t **archetype, ecs->archetypes, {
+        stats.entities += (*archetype)->entities.len;
+        stats.column_bytes += (*archetype)->chunks.len * _ecs_archetype_chunk_size(*archetype, (*archetype)->chunk_cap);
+    });
+
+    _ecs_stat(stats.map_lookups = _ecs_atomic_peek(&ecs->map_stats.lookups));
+    _ecs_stat(stats.map_probes = _ecs_atomic_peek(&ecs->map_stats.probes));
+    _ecs_stat(stats.map_resizes = _ecs_atomic_peek(&ecs->map_stats.resizes));
+
+    return stats;
+}
+
+size_t ecs_stats_archetypes(ecs_t const *ecs, ecs_archetype_stats_t *stats, size_t cap) {
+    size_t i = 0;
+    _ecs_arr_foreach(_ecs_archetype_t **it, ecs->archetypes, {
+        _ecs_archetype_t const *archetype = *it;
+        if (i < cap) {
+            stats[i] = (ecs_archetype_stats_t){
+                .id         = archetype->id,
+                .rows       = archetype->entities.len,
+                .capacity   = archetype->chunks.len * archetype->chunk_cap,
+                .columns    = archetype->layout.len,
+                .chunks     = archetype->chunks.len,
+                .bytes      = archetype->chunks.len * _ecs_archetype_chunk_size(archetype, archetype->chunk_cap),
+            };
+        }
+        i++;
+    });
+    return i;
+}
+
+size_t ecs_stats_columns(ecs_t const *ecs, size_t archetype_index, ecs_column_stats_t *stats, size_t cap) {
+    if (archetype_index >= ecs->archetypes.len) return 0;
+
+    _ecs_archetype_t const *archetype = _ecs_arr_get_as(&ecs->archetypes, archetype_index, _ecs_archetype_t *);
+    for (size_t i = 0; i < archetype->layout.len && i < cap; i++) {
+        _ecs_column_t const *column = _ecs_arr_get(&archetype->layout, i);
+        stats[i] = (ecs_column_stats_t){column->id, column->stride, _ecs_column_bytes(archetype, column)};
+    }
+    return archetype->layout.len;
+}
+
+ecs_system_stats_t ecs_stats_system(ecs_t const *ecs, ecs_id_t system_id) {
+    if (system_id >= ecs->systems.len) return (ecs_system_stats_t){0};
+
+    _ecs_system_t *system = _ecs_arr_get(&ecs->systems, system_id);
+    return (ecs_system_stats_t){_ecs_atomic_load(&system->ns), _ecs_atomic_load(&system->visited), _ecs_atomic_load(&system->runs)};
+}
+
+void ecs_stats_reset(ecs_t *ecs) {
+    ecs->transfers = 0;
+    ecs->trace_last = (ecs_stats_t){0};
+    _ecs_arr_foreach(_ecs_system_t *system, ecs->systems, {
+        _ecs_atomic_store(&system->ns, 0);
+        _ecs_atomic_store(&system->visited, 0);
+        _ecs_atomic_store(&system->runs, 0);
+    });
+
+    _ecs_stat(_ecs_atomic_store(&ecs->map_stats.lookups, 0));
+    _ecs_stat(_ecs_atomic_store(&ecs->map_stats.probes, 0));
+    _ecs_stat(_ecs_atomic_store(&ecs->map_stats.resizes, 0));
+}
+
+#if defined(ECS_STATS)
+// Adds a system run, or one task of it, to the system's totals and to the trace. Safe to call from pool threads.
+static void _ecs_stats_record(ecs_t *ecs, size_t system_id, uint64_t start, uint64_t end, size_t rows) {
+    _ecs_system_t *system = _ecs_arr_get(&ecs->systems, system_id);
+    _ecs_atomic_count(&system->ns, end - start);
+    _ecs_atomic_count(&system->visited, rows);
+    _ecs_atomic_count(&system->runs, 1);
+
+    if (!ecs->trace) return;
+
+    // Chrome wants microseconds. Thread 0 is whoever isn't in the pool.
+    int tid = _ecs_pool_slot(ecs->pool);
+    _ecs_mutex_lock(&ecs->trace_lock);
+    fprintf(ecs->trace,
+        ",\n{\"name\":\"system %zu\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"entities\":%zu}}",
+        system_id, tid, (start - ecs->trace_origin) / 1e3, (end - start) / 1e3, rows);
+    _ecs_mutex_unlock(&ecs->trace_lock);
+}
+#endif
+
+int ecs_trace_begin(ecs_t *ecs, char const *path) {
+    ecs_trace_end(ecs);
+
+    ecs->trace = fopen(path, "w");
+    if (!ecs->trace) return -1;
+
+    ecs->trace_origin = _ecs_clock_ns();
+    ecs->trace_last = ecs_stats(ecs);
+    fprintf(ecs->trace, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"ecs\"}}");
+    return 0;
+}
+
+void ecs_trace_frame(ecs_t *ecs) {
+    if (!ecs->trace) return;
+
+    ecs_stats_t now = ecs_stats(ecs), last = ecs->trace_last;
+    double ts = (_ecs_clock_ns() - ecs->trace_origin) / 1e3;
+
+    _ecs_mutex_lock(&ecs->trace_lock);
+    fprintf(ecs->trace, ",\n{\"name\":\"frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":%.3f}", ts);
+    fprintf(ecs->trace,
+        ",\n{\"name\":\"world\",\"ph\":\"C\",\"pid\":0,\"ts\":%.3f,\"args\":{\"archetypes\":%zu,\"entities\":%zu,\"column_bytes\":%zu}}",
+        ts, now.archetypes, now.entities, now.column_bytes);
+    fprintf(ecs->trace,
+        ",\n{\"name\":\"frame\",\"ph\":\"C\",\"pid\":0,\"ts\":%.3f,\"args\":{\"transfers\":%zu,\"map_lookups\":%zu,\"map_probes\":%zu,\"map_resizes\":%zu}}",
+        ts, now.transfers - last.transfers, now.map_lookups - last.map_lookups,
+        now.map_probes - last.map_probes, now.map_resizes - last.map_resizes);
+    _ecs_mutex_unlock(&ecs->trace_lock);
+
+    ecs->trace_last = now;
+}
+
+void ecs_trace_end(ecs_t *ecs) {
+    if (!ecs->trace) return;
+
+    fprintf(ecs->trace, "\n]\n");
+    fclose(ecs->trace);
+    ecs->trace = NULL;
 }
 
-#endif // ECS_IMPL
+#endif // ECS_IMPL
\ No newline at end of file
@@ -0,0 +1,162 @@
+///////////////////////////////////////////////////////////////////////////////
+///                                                                         ///
+///                           Benchmark harness                             ///
+///                                                                         ///
+///////////////////////////////////////////////////////////////////////////////
+
+// Shared by bench_archetype.c and bench_sparse_set.c, which have to be separate executables since both headers define
+// the same ecs_* functions. Every result is printed as one JSON object per line.
+
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_COUNTERS 4
+
+typedef struct {
+    char const *impl;
+    int fds[BENCH_COUNTERS];    // -1 where the counter couldn't be opened
+    double start;
+} bench_t;
+
+static char const *const bench_counter_names[BENCH_COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Bytes currently allocated on the heap, or 0 where that can't be asked
+static size_t bench_heap(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+static void bench_init(bench_t *b, char const *impl) {
+    b->impl = impl;
+
+#if defined(__linux__)
+    static uint64_t const configs[BENCH_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        struct perf_event_attr attr = {
+            .type           = PERF_TYPE_HARDWARE,
+            .size           = sizeof attr,
+            .config         = configs[i],
+            .disabled       = 1,
+            .exclude_kernel = 1,
+            .exclude_hv     = 1,
+        };
+        b->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#else
+    for (int i = 0; i < BENCH_COUNTERS; i++)
+        b->fds[i] = -1;
+#endif
+}
+
+static void bench_free(bench_t *b) {
+#if defined(__linux__)
+    for (int i = 0; i < BENCH_COUNTERS; i++)
+        if (b->fds[i] >= 0) close(b->fds[i]);
+#endif
+    (void)b;
+}
+
+static void bench_start(bench_t *b) {
+#if defined(__linux__)
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        if (b->fds[i] < 0) continue;
+        ioctl(b->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(b->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    b->start = bench_now();
+}
+
+// Prints the result of the run started by bench_start. `ops` is how many times the measured operation ran, and
+// `bytes_per_entity` is left out when negative.
+static void bench_stop(bench_t *b, char const *workload, size_t entities, size_t ops, double bytes_per_entity) {
+    double elapsed = bench_now() - b->start;
+
+    printf("{\"impl\": \"%s\", \"workload\": \"%s\", \"entities\": %zu, \"ops\": %zu, \"ns_per_op\": %.3f",
+        b->impl, workload, entities, ops, elapsed * 1e9 / ops);
+
+    if (bytes_per_entity >= 0)
+        printf(", \"bytes_per_entity\": %.1f", bytes_per_entity);
+
+#if defined(__linux__)
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        uint64_t count;
+        if (b->fds[i] < 0) continue;
+
+        ioctl(b->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(b->fds[i], &count, sizeof count) == sizeof count)
+            printf(", \"%s_per_op\": %.3f", bench_counter_names[i], (double)count / ops);
+    }
+#endif
+
+    printf("}\n");
+    fflush(stdout);
+}
+
+// Repetitions that keep small runs long enough to time
+static size_t bench_reps(size_t entities) {
+    size_t reps = 10000000 / entities;
+    return reps ? reps : 1;
+}
+
+// Entity counts to run, capped by the first argument (e.g. `bench_archetype 1000000` skips 10M)
+static size_t bench_sizes(int argc, char **argv, size_t *sizes) {
+    static size_t const all[] = {10000, 1000000, 10000000};
+    size_t max = argc > 1 ? strtoull(argv[1], NULL, 10) : SIZE_MAX;
+    size_t count = 0;
+
+    for (size_t i = 0; i < sizeof all / sizeof *all; i++)
+        if (all[i] <= max)
+            sizes[count++] = all[i];
+
+    return count;
+}
+
+static uint64_t bench_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Fisher-Yates, so random access hits every entity exactly once
+static void bench_shuffle(uint64_t *ids, size_t count) {
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (size_t i = count; i > 1; i--) {
+        size_t j = bench_rand(&state) % i;
+        uint64_t t = ids[i - 1];
+        ids[i - 1] = ids[j];
+        ids[j] = t;
+    }
+}
@@ -0,0 +1,159 @@
+#define ECS_IMPL
+#include "../archetype.h"
+#include "bench.h"
+
+typedef struct { float x, y; } vec2;
+
+// The components are registered by name so systems can list them as plain strings
+static char const *const names[] = {"c0", "c1", "c2", "c3", "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7"};
+static ecs_id_t c[12];
+static float sink;
+
+static ecs_t *world(void) {
+    ecs_t *ecs = ecs_create(0);
+    for (int i = 0; i < 12; i++)
+        c[i] = _ecs_component(ecs, names[i], i < 4 ? sizeof (vec2) : sizeof (int));
+    return ecs;
+}
+
+static void iterate_1(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    vec2 *a = ecs_field_id(components, c[0]);
+    for (size_t i = 0; i < count; i++)
+        a[i].x += 1;
+}
+
+static void iterate_2(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    vec2 *a = ecs_field_id(components, c[0]), *b = ecs_field_id(components, c[1]);
+    for (size_t i = 0; i < count; i++)
+        a[i].x += b[i].x;
+}
+
+static void iterate_4(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    vec2 *a = ecs_field_id(components, c[0]), *b = ecs_field_id(components, c[1]);
+    vec2 *d = ecs_field_id(components, c[2]), *e = ecs_field_id(components, c[3]);
+    for (size_t i = 0; i < count; i++)
+        a[i].x += b[i].x + d[i].y + e[i].y;
+}
+
+static void bench_iterate(bench_t *b, size_t n, int k) {
+    static void (*const systems[])(void *, ecs_id_t *, size_t) = {[1] = iterate_1, [2] = iterate_2, [4] = iterate_4};
+    static char const *const lists[] = {[1] = "c0", [2] = "c0, const c1", [4] = "c0, const c1, const c2, const c3"};
+    static char const *const workloads[] = {[1] = "iterate_1", [2] = "iterate_2", [4] = "iterate_4"};
+
+    size_t heap = bench_heap();
+    ecs_t *ecs = world();
+    ecs_spawn_n(ecs, n, NULL, k, c, NULL);
+    ecs_id_t system = _ecs_register(ecs, systems[k], lists[k]);
+    double bytes = (double)(bench_heap() - heap) / n;
+
+    size_t reps = bench_reps(n);
+    bench_start(b);
+    for (size_t r = 0; r < reps; r++)
+        ecs_run(ecs, system);
+    bench_stop(b, workloads[k], n, n * reps, bytes);
+
+    ecs_delete(ecs);
+}
+
+static void bench_churn(bench_t *b, size_t n) {
+    ecs_t *ecs = world();
+    ecs_id_t *ids = malloc(n * sizeof *ids);
+
+    bench_start(b);
+    for (size_t i = 0; i < n; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set_many(ecs, ids[i], 2, c, (void const *[]){&(vec2){1, 2}, &(vec2){3, 4}});
+    }
+    for (size_t i = 0; i < n; i++)
+        ecs_despawn(ecs, ids[i]);
+    bench_stop(b, "spawn_despawn", n, n, -1);
+
+    free(ids);
+    ecs_delete(ecs);
+}
+
+static void bench_add_remove(bench_t *b, size_t n) {
+    ecs_t *ecs = world();
+    ecs_id_t *ids = malloc(n * sizeof *ids);
+    ecs_spawn_n(ecs, n, ids, 1, c, NULL);
+
+    bench_start(b);
+    for (size_t i = 0; i < n; i++)
+        ecs_set_id(ecs, ids[i], c[1], &(vec2){1, 2});
+    for (size_t i = 0; i < n; i++)
+        ecs_rem_id(ecs, ids[i], c[1]);
+    bench_stop(b, "add_remove", n, n, -1);
+
+    free(ids);
+    ecs_delete(ecs);
+}
+
+static void bench_get(bench_t *b, size_t n) {
+    ecs_t *ecs = world();
+    ecs_id_t *ids = malloc(n * sizeof *ids);
+    ecs_spawn_n(ecs, n, ids, 2, c, NULL);
+    bench_shuffle(ids, n);
+
+    bench_start(b);
+    for (size_t i = 0; i < n; i++)
+        sink += ((vec2 *)ecs_get_id(ecs, ids[i], c[1]))->x;
+    bench_stop(b, "random_get", n, n, -1);
+
+    free(ids);
+    ecs_delete(ecs);
+}
+
+// Every entity has c0 plus one of the 256 combinations of the t* tags
+static void bench_fragmented(bench_t *b, size_t n) {
+    size_t heap = bench_heap();
+    ecs_t *ecs = world();
+
+    size_t per = n / 256;
+    for (size_t combo = 0; combo < 256; combo++) {
+        ecs_id_t ids[9] = {c[0]};
+        size_t count = 1;
+        for (int t = 0; t < 8; t++)
+            if (combo & (1u << t))
+                ids[count++] = c[4 + t];
+        ecs_spawn_n(ecs, per, NULL, count, ids, NULL);
+    }
+
+    ecs_id_t system = _ecs_register(ecs, iterate_1, "c0");
+    double bytes = (double)(bench_heap() - heap) / (per * 256);
+
+    size_t reps = bench_reps(per * 256);
+    bench_start(b);
+    for (size_t r = 0; r < reps; r++)
+        ecs_run(ecs, system);
+    bench_stop(b, "fragmented_iterate", per * 256, per * 256 * reps, bytes);
+
+    ecs_delete(ecs);
+}
+
+int main(int argc, char **argv) {
+    bench_t b;
+    bench_init(&b, "archetype");
+
+    size_t sizes[3];
+    size_t count = bench_sizes(argc, argv, sizes);
+
+    for (size_t i = 0; i < count; i++) {
+        bench_iterate(&b, sizes[i], 1);
+        bench_iterate(&b, sizes[i], 2);
+        bench_iterate(&b, sizes[i], 4);
+    }
+
+    // Structural changes and lookups get slow enough that 10M entities only adds run time
+    for (size_t i = 0; i < count && sizes[i] <= 1000000; i++) {
+        bench_churn(&b, sizes[i]);
+        bench_add_remove(&b, sizes[i]);
+        bench_get(&b, sizes[i]);
+        bench_fragmented(&b, sizes[i]);
+    }
+
+    bench_free(&b);
+    return sink == 12345.f;
+}
@@ -0,0 +1,172 @@
+#define ECS_IMPL
+#include "../sparse_set.h"
+#include "bench.h"
+
+typedef struct { float x, y; } vec2;
+
+enum { C0, C1, C2, C3, T0 };
+static float sink;
+
+static ecs_t *world(void) {
+    return ecs_create(12,
+        sizeof (vec2), sizeof (vec2), sizeof (vec2), sizeof (vec2),
+        sizeof (int), sizeof (int), sizeof (int), sizeof (int),
+        sizeof (int), sizeof (int), sizeof (int), sizeof (int));
+}
+
+static void spawn(ecs_t *ecs, size_t n, int k, ecs_id_t *ids) {
+    for (size_t i = 0; i < n; i++) {
+        ecs_id_t e = ecs_spawn(ecs);
+        for (int j = 0; j < k; j++)
+            ecs_set(ecs, e, j, &(vec2){1, 2});
+        if (ids) ids[i] = e;
+    }
+}
+
+static void bench_iterate(bench_t *b, size_t n, int k) {
+    static char const *const workloads[] = {[1] = "iterate_1", [2] = "iterate_2", [4] = "iterate_4"};
+
+    size_t heap = bench_heap();
+    ecs_t *ecs = world();
+    spawn(ecs, n, k, NULL);
+    double bytes = (double)(bench_heap() - heap) / n;
+
+    size_t reps = bench_reps(n);
+    bench_start(b);
+    for (size_t r = 0; r < reps; r++) {
+        ecs_view_t v = k == 1 ? ecs_query(ecs, 1, C0) : k == 2 ? ecs_query(ecs, 2, C0, C1) : ecs_query(ecs, 4, C0, C1, C2, C3);
+        for (; ecs_valid(&v); ecs_next(&v)) {
+            vec2 *a = ecs_column(&v, C0);
+            if (k >= 2) a->x += ((vec2 *)ecs_column(&v, C1))->x;
+            if (k >= 4) a->x += ((vec2 *)ecs_column(&v, C2))->y + ((vec2 *)ecs_column(&v, C3))->y;
+            if (k == 1) a->x += 1;
+        }
+    }
+    bench_stop(b, workloads[k], n, n * reps, bytes);
+
+    ecs_delete(ecs);
+}
+
+// The same loops over an owning group's packed columns
+static void bench_group(bench_t *b, size_t n, int k) {
+    ecs_t *ecs = world();
+    spawn(ecs, n, k, NULL);
+    int g = k == 2 ? ecs_group(ecs, 2, C0, C1) : ecs_group(ecs, 4, C0, C1, C2, C3);
+
+    size_t reps = bench_reps(n);
+    bench_start(b);
+    for (size_t r = 0; r < reps; r++) {
+        size_t count = ecs_group_count(ecs, g);
+        vec2 *a = ecs_group_column(ecs, g, C0), *v = ecs_group_column(ecs, g, C1);
+        if (k == 2) {
+            for (size_t i = 0; i < count; i++)
+                a[i].x += v[i].x;
+        } else {
+            vec2 *d = ecs_group_column(ecs, g, C2), *e = ecs_group_column(ecs, g, C3);
+            for (size_t i = 0; i < count; i++)
+                a[i].x += v[i].x + d[i].y + e[i].y;
+        }
+    }
+    bench_stop(b, k == 2 ? "iterate_2_group" : "iterate_4_group", n, n * reps, -1);
+
+    ecs_delete(ecs);
+}
+
+static void bench_churn(bench_t *b, size_t n) {
+    ecs_t *ecs = world();
+    ecs_id_t *ids = malloc(n * sizeof *ids);
+
+    bench_start(b);
+    spawn(ecs, n, 2, ids);
+    for (size_t i = 0; i < n; i++)
+        ecs_despawn(ecs, ids[i]);
+    bench_stop(b, "spawn_despawn", n, n, -1);
+
+    free(ids);
+    ecs_delete(ecs);
+}
+
+static void bench_add_remove(bench_t *b, size_t n) {
+    ecs_t *ecs = world();
+    ecs_id_t *ids = malloc(n * sizeof *ids);
+    spawn(ecs, n, 1, ids);
+
+    bench_start(b);
+    for (size_t i = 0; i < n; i++)
+        ecs_set(ecs, ids[i], C1, &(vec2){1, 2});
+    for (size_t i = 0; i < n; i++)
+        ecs_rem(ecs, ids[i], C1);
+    bench_stop(b, "add_remove", n, n, -1);
+
+    free(ids);
+    ecs_delete(ecs);
+}
+
+static void bench_get(bench_t *b, size_t n) {
+    ecs_t *ecs = world();
+    ecs_id_t *ids = malloc(n * sizeof *ids);
+    spawn(ecs, n, 2, ids);
+    bench_shuffle(ids, n);
+
+    bench_start(b);
+    for (size_t i = 0; i < n; i++)
+        sink += ((vec2 *)ecs_get(ecs, ids[i], C1))->x;
+    bench_stop(b, "random_get", n, n, -1);
+
+    free(ids);
+    ecs_delete(ecs);
+}
+
+// Every entity has C0 plus one of the 256 combinations of the tag pools
+static void bench_fragmented(bench_t *b, size_t n) {
+    size_t heap = bench_heap();
+    ecs_t *ecs = world();
+
+    size_t per = n / 256;
+    for (size_t combo = 0; combo < 256; combo++) {
+        for (size_t i = 0; i < per; i++) {
+            ecs_id_t e = ecs_spawn(ecs);
+            ecs_set(ecs, e, C0, &(vec2){1, 2});
+            for (int t = 0; t < 8; t++)
+                if (combo & (1u << t))
+                    ecs_set(ecs, e, T0 + t, &(int){t});
+        }
+    }
+    double bytes = (double)(bench_heap() - heap) / (per * 256);
+
+    size_t reps = bench_reps(per * 256);
+    bench_start(b);
+    for (size_t r = 0; r < reps; r++)
+        for (ecs_view_t v = ecs_query(ecs, 1, C0); ecs_valid(&v); ecs_next(&v))
+            ((vec2 *)ecs_column(&v, C0))->x += 1;
+    bench_stop(b, "fragmented_iterate", per * 256, per * 256 * reps, bytes);
+
+    ecs_delete(ecs);
+}
+
+int main(int argc, char **argv) {
+    bench_t b;
+    bench_init(&b, "sparse_set");
+
+    size_t sizes[3];
+    size_t count = bench_sizes(argc, argv, sizes);
+
+    for (size_t i = 0; i < count; i++) {
+        bench_iterate(&b, sizes[i], 1);
+        bench_iterate(&b, sizes[i], 2);
+        bench_iterate(&b, sizes[i], 4);
+        bench_group(&b, sizes[i], 2);
+        bench_group(&b, sizes[i], 4);
+    }
+
+    // Structural changes and lookups get slow enough that 10M entities only adds run time
+    for (size_t i = 0; i < count && sizes[i] <= 1000000; i++) {
+        bench_churn(&b, sizes[i]);
+        bench_add_remove(&b, sizes[i]);
+        bench_get(&b, sizes[i]);
+        bench_fragmented(&b, sizes[i]);
+    }
+
+    bench_free(&b);
+    return sink == 12345.f;
+}
@@ -12,16 +12,34 @@ typedef uint64_t ecs_id_t;
 
 typedef struct ecs_t ecs_t;
 
+// Where a world gets its memory. `realloc` and `free` are told the size the block has. If `release` is set,
+// ecs_delete calls it instead of freeing the world's blocks one by one.
+typedef struct {
+    void       *(*alloc)    (void *ctx, size_t size, size_t align);
+    void       *(*realloc)  (void *ctx, void *ptr, size_t old_size, size_t size);
+    void        (*free)     (void *ctx, void *ptr, size_t size);
+    void        (*release)  (void *ctx);
+    void       *ctx;
+} ecs_allocator_t;
+
 typedef struct {
     void *pool, *pools[16];
     int index_to_com[16];
     int count;
     size_t entity_index;
     uint64_t entity;
+    uint32_t tick, since;
+    int filter;
 } ecs_view_t;
 
 ecs_t      *ecs_create  (int count, ...);
+ecs_t      *ecs_create_with (ecs_allocator_t const *allocator, int count, ...);
 void        ecs_delete  (ecs_t *ecs);
+
+// An allocator that carves blocks of `block_size` bytes (0 for 1MB) front to back and only frees them all at once,
+// when the world it is given to is deleted. If it can't get memory for its own state, every field of the allocator
+// is NULL and ecs_create_with returns NULL.
+ecs_allocator_t ecs_arena   (size_t block_size);
 void        ecs_set     (ecs_t *ecs, ecs_id_t entity, int component, void const *data);
 void       *ecs_get     (ecs_t const *ecs, ecs_id_t entity, int component);
 void        ecs_rem     (ecs_t *ecs, ecs_id_t entity, int component);
@@ -29,11 +47,55 @@ void        ecs_rem     (ecs_t *ecs, ecs_id_t entity, int component);
 ecs_id_t    ecs_spawn   (ecs_t *ecs);
 void        ecs_despawn (ecs_t *ecs, ecs_id_t entity);
 
+// Despawns `count` entities and removes all of their components, with one sweep over each pool when that is cheaper
+// than removing them one at a time. Ids that are not alive are skipped.
+void        ecs_despawn_n (ecs_t *ecs, ecs_id_t const *entities, size_t count);
+
 ecs_view_t  ecs_query   (ecs_t *ecs, int count, ...);
 int         ecs_valid   (ecs_view_t const *view);
 void        ecs_next    (ecs_view_t *view);
 void       *ecs_column  (ecs_view_t const *view, int component);
 
+// Every row keeps the tick it last got each component (ECS_ADDED) and was last written (ECS_CHANGED). Writes are
+// ecs_set and ecs_column_mut, and are stamped with the world's tick, which starts at 1 and only moves on ecs_advance.
+#define     ECS_CHANGED 1
+#define     ECS_ADDED   2
+uint32_t    ecs_tick        (ecs_t const *ecs);
+uint32_t    ecs_advance     (ecs_t *ecs);
+
+// Like ecs_query, but skips the entities where none of the components were changed or added after `since`.
+// Only the tick arrays are looked at, never the component data.
+ecs_view_t  ecs_query_since (ecs_t *ecs, int filter, uint32_t since, int count, ...);
+void       *ecs_column_mut  (ecs_view_t *view, int component); // Like ecs_column, and marks the value changed
+
+// An owning group keeps the entities that have all of its components packed at the front of each component's pool,
+// in the same order, so the group's columns can be walked as plain arrays:
+//
+//  int g = ecs_group(ecs, 2, POSITION, VELOCITY);
+//  ivec2 *p = ecs_group_column(ecs, g, POSITION), *v = ecs_group_column(ecs, g, VELOCITY);
+//  for (size_t i = 0; i < ecs_group_count(ecs, g); i++) p[i].x += v[i].x;
+//
+// A component can only be owned by one group, ecs_group returns -1 if one of them already is, or if it is given no
+// components, more than 16 or ones out of range.
+int         ecs_group           (ecs_t *ecs, int count, ...);
+size_t      ecs_group_count     (ecs_t const *ecs, int group);
+ecs_id_t   *ecs_group_entities  (ecs_t const *ecs, int group);
+void       *ecs_group_column    (ecs_t const *ecs, int group, int component);
+
+// Reorder a pool's entities, with their data and ticks, in place. ecs_sort orders them by `cmp`, which gets two
+// entities and their values (NULL sorts by entity index), and keeps equal ones in the order they were. ecs_sort_as
+// puts the entities `component` shares with `other` first, in `other`'s order, so a query over both walks the two
+// pools front to back. Pools owned by a group are kept in the group's order, both return -1 for them.
+typedef int (*ecs_cmp_t)(ecs_id_t a, void const *a_data, ecs_id_t b, void const *b_data, void *ctx);
+int         ecs_sort            (ecs_t *ecs, int component, ecs_cmp_t cmp, void *ctx);
+int         ecs_sort_as         (ecs_t *ecs, int component, int other);
+
+// Writes every pool's dense and data arrays to `path` as contiguous blocks, and reads them back into a new world with
+// one copy per block. Groups aren't saved, declare them again after loading. ecs_save returns 0 on success, ecs_load
+// NULL on failure.
+int         ecs_save            (ecs_t const *ecs, char const *path);
+ecs_t      *ecs_load            (char const *path);
+
 ///////////////////////////////////////////////////////////////////////////////
 ///                                                                         ///
 ///                             Implementation                              ///
@@ -43,29 +105,178 @@ void       *ecs_column  (ecs_view_t const *view, int component);
 #if defined(ECS_IMPL)
 
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+///////////////////////////////////////////////////////////////////////////////
+/// Allocator
+
+#define _ecs_align(x, a)    (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+#if __STDC_VERSION__ >= 201112L
+#define _ecs_alignof(T)     _Alignof (T)
+#define _ecs_min_align      _Alignof (max_align_t)
+
+static void *_ecs_libc_alloc(void *ctx, size_t size, size_t align) {
+    (void)ctx;
+    if (align <= _ecs_min_align)
+        return malloc(size ? size : 1);
+    return aligned_alloc(align, _ecs_align(size ? size : 1, align));
+}
+
+static void *_ecs_libc_realloc(void *ctx, void *ptr, size_t old_size, size_t size) {
+    (void)ctx, (void)old_size;
+    return realloc(ptr, size ? size : 1);
+}
+
+static void _ecs_libc_free(void *ctx, void *ptr, size_t size) {
+    (void)ctx, (void)size;
+    free(ptr);
+}
+#else
+// C99 has neither alignof nor aligned_alloc. Every block is then placed `align` (at least _ecs_min_align) bytes into
+// a larger one from malloc, with the pointer malloc returned stored just before it.
+typedef union {
+    long double ld;
+    long long ll;
+    void *p;
+    void (*fn)(void);
+} _ecs_max_align_t;
+
+#define _ecs_alignof(T)     offsetof(struct { char c; T t; }, t)
+#define _ecs_min_align      _ecs_alignof(_ecs_max_align_t)
+#define _ecs_libc_base(ptr) (((void **)(ptr))[-1])
+
+static void *_ecs_libc_alloc(void *ctx, size_t size, size_t align) {
+    (void)ctx;
+    if (align < _ecs_min_align) align = _ecs_min_align;
+    char *base = malloc(size + align);
+    if (!base) return NULL;
+
+    char *ptr = base + _ecs_align((size_t)(uintptr_t)base + sizeof (void *), align) - (size_t)(uintptr_t)base;
+    _ecs_libc_base(ptr) = base;
+    return ptr;
+}
+
+// Only ever given blocks aligned to _ecs_min_align, which all sit that many bytes into theirs
+static void *_ecs_libc_realloc(void *ctx, void *ptr, size_t old_size, size_t size) {
+    (void)ctx, (void)old_size;
+    char *base = realloc(ptr ? _ecs_libc_base(ptr) : NULL, size + _ecs_min_align);
+    if (!base) return NULL;
+
+    _ecs_libc_base(base + _ecs_min_align) = base;
+    return base + _ecs_min_align;
+}
+
+static void _ecs_libc_free(void *ctx, void *ptr, size_t size) {
+    (void)ctx, (void)size;
+    if (ptr) free(_ecs_libc_base(ptr));
+}
+#endif
+
+static ecs_allocator_t const _ecs_libc = {_ecs_libc_alloc, _ecs_libc_realloc, _ecs_libc_free, NULL, NULL};
+
+typedef struct _ecs_arena_block_t {
+    struct _ecs_arena_block_t *next;
+    size_t size;
+    size_t used;
+} _ecs_arena_block_t;
+
+typedef struct {
+    _ecs_arena_block_t *head;
+    size_t block_size;
+} _ecs_arena_t;
+
+static void *_ecs_arena_alloc(void *ctx, size_t size, size_t align) {
+    _ecs_arena_t *arena = ctx;
+    _ecs_arena_block_t *block = arena->head;
+    size_t header = _ecs_align(sizeof *block, _ecs_min_align);
+
+    // Offsets are from the start of the block's data, aligned as addresses
+    uintptr_t base = (uintptr_t)block + header;
+    size_t at = block ? _ecs_align(base + block->used, align) - base : 0;
+
+    if (!block || at + size > block->size) {
+        // Bigger requests get a block of their own
+        size_t block_size = arena->block_size > size + align ? arena->block_size : size + align;
+        block = malloc(header + block_size);
+        if (!block) return NULL;
+
+        *block = (_ecs_arena_block_t){.next = arena->head, .size = block_size};
+        arena->head = block;
+        base = (uintptr_t)block + header;
+        at = _ecs_align(base, align) - base;
+    }
+
+    block->used = at + size;
+    return (char *)base + at;
+}
+
+// Whether `ptr` is the last thing handed out, which can still grow, shrink or be taken back in place
+static int _ecs_arena_last(_ecs_arena_t const *arena, void const *ptr, size_t size) {
+    _ecs_arena_block_t const *block = arena->head;
+    return block && (char const *)ptr + size == (char const *)block + _ecs_align(sizeof *block, _ecs_min_align) + block->used;
+}
+
+static void *_ecs_arena_realloc(void *ctx, void *ptr, size_t old_size, size_t size) {
+    _ecs_arena_t *arena = ctx;
+    if (ptr && _ecs_arena_last(arena, ptr, old_size) && arena->head->used - old_size + size <= arena->head->size) {
+        arena->head->used = arena->head->used - old_size + size;
+        return ptr;
+    }
+
+    void *p = _ecs_arena_alloc(ctx, size, _ecs_min_align);
+    if (p && ptr) memcpy(p, ptr, old_size < size ? old_size : size);
+    return p;
+}
+
+static void _ecs_arena_free(void *ctx, void *ptr, size_t size) {
+    _ecs_arena_t *arena = ctx;
+    if (ptr && _ecs_arena_last(arena, ptr, size))
+        arena->head->used -= size;
+}
+
+static void _ecs_arena_release(void *ctx) {
+    _ecs_arena_t *arena = ctx;
+    for (_ecs_arena_block_t *block = arena->head, *next; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(arena);
+}
+
+ecs_allocator_t ecs_arena(size_t block_size) {
+    _ecs_arena_t *arena = malloc(sizeof *arena);
+    if (!arena) return (ecs_allocator_t){0};
+
+    *arena = (_ecs_arena_t){.block_size = block_size ? block_size : 1 << 20};
+    return (ecs_allocator_t){_ecs_arena_alloc, _ecs_arena_realloc, _ecs_arena_free, _ecs_arena_release, arena};
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Buffer / Array
 
-#define _ecs_buf_free(b)            ((b) ? free(_ecs_buf__raw(b)), 0 : 0)
-#define _ecs_buf_reserve(b, n, sz)  (!(b) || _ecs_buf__len(b) + ((n) * (sz)) > _ecs_buf__cap(b) ? b = _ecs_buf_grow((b), _ecs_buf_len(b) + ((n) * (sz))), 0 : 0)
+// Buffers that grow take the allocator `a` they live in
+#define _ecs_buf_free(a, b)             ((b) ? (a)->free((a)->ctx, _ecs_buf__raw(b), _ecs_buf__size(b)), 0 : 0)
+#define _ecs_buf_reserve(a, b, n, sz)   (!(b) || _ecs_buf__len(b) + ((n) * (sz)) > _ecs_buf__cap(b) ? b = _ecs_buf_grow((a), (b), _ecs_buf_len(b) + ((n) * (sz))), 0 : 0)
 #define _ecs_buf_len(b)             ((b) ? _ecs_buf__len(b) : 0)
 #define _ecs_buf_get(b, i, sz)      ((void *)&((char *)(b))[(i) * (sz)])
 #define _ecs_buf_set(b, i, x, sz)   (memcpy(&((char *)(b))[(i) * (sz)], (x), (sz)))
-#define _ecs_buf_addn(b, n, sz)     (_ecs_buf_reserve(b, n, sz), _ecs_buf__len(b) += (n) * (sz), &((char *)(b))[_ecs_buf__len(b) - ((n) * (sz))])
-#define _ecs_buf_push(b, x, sz)     (memcpy(_ecs_buf_addn(b, 1, sz), (x), (sz)))
+#define _ecs_buf_addn(a, b, n, sz)  (_ecs_buf_reserve(a, b, n, sz), _ecs_buf__len(b) += (n) * (sz), &((char *)(b))[_ecs_buf__len(b) - ((n) * (sz))])
+#define _ecs_buf_push(a, b, x, sz)  (memcpy(_ecs_buf_addn(a, b, 1, sz), (x), (sz)))
 #define _ecs_buf_pop(b, sz)         ((void *)&((char *)(b))[_ecs_buf__len(b) -= (sz)])
 #define _ecs_buf__raw(b)            ((size_t *)(b) - 2)
 #define _ecs_buf__cap(b)            (_ecs_buf__raw(b)[0])
 #define _ecs_buf__len(b)            (_ecs_buf__raw(b)[1])
+#define _ecs_buf__size(b)           (sizeof (size_t) * 2 + _ecs_buf__cap(b))
 
-static void *_ecs_buf_grow(void *b, size_t n) {
+static void *_ecs_buf_grow(ecs_allocator_t const *a, void *b, size_t n) {
     size_t m = b ? _ecs_buf__len(b) : 16;
     while (m < n) m *= 2;
 
-    size_t *c = realloc(b ? _ecs_buf__raw(b) : b, (sizeof *c * 2) + m);
+    size_t *c = b ? a->realloc(a->ctx, _ecs_buf__raw(b), _ecs_buf__size(b), (sizeof *c * 2) + m)
+                  : a->alloc(a->ctx, (sizeof *c * 2) + m, _ecs_min_align);
     c += 2;
 
     if (!b) _ecs_buf__len(c) = 0;
@@ -74,103 +285,235 @@ static void *_ecs_buf_grow(void *b, size_t n) {
     return c;
 }
 
-#define _ecs_arr_free(a)     (_ecs_buf_free(a))
-#define _ecs_arr_len(a)      (_ecs_buf_len(a) / sizeof *(a))
-#define _ecs_arr_addn(a, n)  (_ecs_buf_addn(a, n, sizeof *(a)))
-#define _ecs_arr_push(a, x)  (_ecs_buf_push(a, x, sizeof *(a)))
-#define _ecs_arr_pop(a)      ((a)[_ecs_buf__len(a) -= sizeof *(a)])
+#define _ecs_arr_free(al, a)     (_ecs_buf_free(al, a))
+#define _ecs_arr_len(a)          (_ecs_buf_len(a) / sizeof *(a))
+#define _ecs_arr_addn(al, a, n)  (_ecs_buf_addn(al, a, n, sizeof *(a)))
+#define _ecs_arr_push(al, a, x)  (_ecs_buf_push(al, a, x, sizeof *(a)))
+#define _ecs_arr_pop(a)          ((a)[(_ecs_buf__len(a) -= sizeof *(a)) / sizeof *(a)])
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Pool
 
+// The sparse side is split into pages of `_ecs_page_size` slots, allocated the first time an entity index in their
+// range gets the component. Slots hold the entity's position in `dense`.
+#define _ecs_page_size  4096
+
 typedef struct {
-    size_t *sparse;
+    uint32_t **sparse;
     ecs_id_t *dense;
     void *data;
+    uint32_t *changed;  // Ticks, indexed like `dense`
+    uint32_t *added;
     size_t stride;
+    int group;          // Index + 1 of the group owning this pool, 0 if none
+    ecs_allocator_t const *allocator;
 } _ecs_pool_t;
 
 #define _ecs_lo32(x)    ((x) & 0xffffffff)
 #define _ecs_hi32(x)    (_ecs_lo32((x) >> 32))
 #define _ecs_mk64(h, l) (((uint64_t)(h) << 32) | _ecs_lo32(l))
 
-static _ecs_pool_t _ecs_pool_make(size_t stride) {
-    return (_ecs_pool_t){.stride = stride};
+// The slot of an entity whose page exists
+#define _ecs_sparse(p, e)   ((p)->sparse[_ecs_lo32(e) / _ecs_page_size][_ecs_lo32(e) % _ecs_page_size])
+
+static _ecs_pool_t _ecs_pool_make(ecs_allocator_t const *allocator, size_t stride) {
+    return (_ecs_pool_t){.stride = stride, .allocator = allocator};
 }
 
 static int _ecs_pool_has(_ecs_pool_t const *p, ecs_id_t e) {
-    size_t idx = p->sparse[_ecs_lo32(e)];
+    size_t page = _ecs_lo32(e) / _ecs_page_size;
+    if (page >= _ecs_arr_len(p->sparse) || !p->sparse[page]) return 0;
+    size_t idx = _ecs_sparse(p, e);
     return idx < _ecs_arr_len(p->dense) && p->dense[idx] == e;
 }
 
 static void *_ecs_pool_get(_ecs_pool_t const *p, ecs_id_t e) {
-    return _ecs_pool_has(p, e) ? _ecs_buf_get(p->data, p->sparse[_ecs_lo32(e)], p->stride) : NULL;
+    return _ecs_pool_has(p, e) ? _ecs_buf_get(p->data, _ecs_sparse(p, e), p->stride) : NULL;
+}
+
+// Makes sure the page holding `e`'s slot exists. Only the page table grows, pages already allocated never move.
+static void _ecs_pool_page(_ecs_pool_t *p, ecs_id_t e) {
+    size_t page = _ecs_lo32(e) / _ecs_page_size, len = _ecs_arr_len(p->sparse);
+    if (page >= len)
+        memset(_ecs_arr_addn(p->allocator, p->sparse, page + 1 - len), 0, (page + 1 - len) * sizeof *p->sparse);
+    if (!p->sparse[page]) {
+        p->sparse[page] = p->allocator->alloc(p->allocator->ctx, _ecs_page_size * sizeof **p->sparse, _ecs_min_align);
+        memset(p->sparse[page], 0, _ecs_page_size * sizeof **p->sparse);
+    }
 }
 
-static void _ecs_pool_set(_ecs_pool_t *p, ecs_id_t e, void const *data) {
-    _ecs_buf_reserve(p->sparse, _ecs_lo32(e), sizeof *p->sparse);
-    p->sparse[_ecs_lo32(e)] = _ecs_arr_len(p->dense);
-    _ecs_buf__len(p->sparse)++;
+static void _ecs_pool_set(_ecs_pool_t *p, ecs_id_t e, void const *data, uint32_t tick) {
+    // Overwrite in place, a second dense entry would break removal and groups
+    if (_ecs_pool_has(p, e)) {
+        _ecs_buf_set(p->data, _ecs_sparse(p, e), data, p->stride);
+        p->changed[_ecs_sparse(p, e)] = tick;
+        return;
+    }
 
-    _ecs_arr_push(p->dense, &e);
-    _ecs_buf_push(p->data, data, p->stride);
+    _ecs_pool_page(p, e);
+    _ecs_sparse(p, e) = (uint32_t)_ecs_arr_len(p->dense);
+    _ecs_arr_push(p->allocator, p->dense, &e);
+    _ecs_buf_push(p->allocator, p->data, data, p->stride);
+    _ecs_arr_push(p->allocator, p->changed, &tick);
+    _ecs_arr_push(p->allocator, p->added, &tick);
 }
 
 static void _ecs_pool_rem(_ecs_pool_t *p, ecs_id_t e) {
-    size_t pos = p->sparse[_ecs_lo32(e)];
+    size_t pos = _ecs_sparse(p, e);
     ecs_id_t rem = _ecs_arr_pop(p->dense);
+    void *last = _ecs_buf_pop(p->data, p->stride);
+    uint32_t changed = _ecs_arr_pop(p->changed);
+    uint32_t added = _ecs_arr_pop(p->added);
+    if (rem == e) return;
 
-    p->sparse[_ecs_lo32(rem)] = pos;
-    _ecs_buf__len(p->sparse)--;
-
+    _ecs_sparse(p, rem) = pos;
     p->dense[pos] = rem;
-    _ecs_buf_set(p->data, pos, _ecs_buf_pop(p->data, p->stride), p->stride);
+    p->changed[pos] = changed;
+    p->added[pos] = added;
+    _ecs_buf_set(p->data, pos, last, p->stride);
+}
+
+// Swaps the entities at dense positions `a` and `b`, along with their data
+static void _ecs_pool_swap(_ecs_pool_t *p, size_t a, size_t b) {
+    if (a == b) return;
+
+    ecs_id_t ea = p->dense[a], eb = p->dense[b];
+    p->dense[a] = eb;
+    p->dense[b] = ea;
+    _ecs_sparse(p, ea) = b;
+    _ecs_sparse(p, eb) = a;
+
+    uint32_t t = p->changed[a];
+    p->changed[a] = p->changed[b];
+    p->changed[b] = t;
+    t = p->added[a];
+    p->added[a] = p->added[b];
+    p->added[b] = t;
+
+    char *x = _ecs_buf_get(p->data, a, p->stride);
+    char *y = _ecs_buf_get(p->data, b, p->stride);
+    for (size_t i = 0; i < p->stride; i++) {
+        char t = x[i];
+        x[i] = y[i];
+        y[i] = t;
+    }
+}
+
+// Drops the entries from `from` on whose entity is no longer alive in `entities`, filling each hole with the last
+// entry, in one pass
+static void _ecs_pool_sweep(_ecs_pool_t *p, size_t from, ecs_id_t const *entities) {
+    size_t len = _ecs_arr_len(p->dense);
+
+    for (size_t i = from; i < len;) {
+        ecs_id_t e = p->dense[i];
+        if (entities[_ecs_lo32(e)] == e) {
+            i++;
+            continue;
+        }
+
+        if (i == --len) break;
+        e = p->dense[len];
+        _ecs_sparse(p, e) = i;
+        p->dense[i] = e;
+        p->changed[i] = p->changed[len];
+        p->added[i] = p->added[len];
+        _ecs_buf_set(p->data, i, _ecs_buf_get(p->data, len, p->stride), p->stride);
+    }
+
+    _ecs_buf__len(p->dense) = len * sizeof *p->dense;
+    _ecs_buf__len(p->changed) = len * sizeof *p->changed;
+    _ecs_buf__len(p->added) = len * sizeof *p->added;
+    if (p->data) _ecs_buf__len(p->data) = len * p->stride;
 }
 
 static void _ecs_pool_free(_ecs_pool_t *p) {
-    _ecs_arr_free(p->sparse);
-    _ecs_arr_free(p->dense);
-    _ecs_buf_free(p->data);
+    for (size_t i = 0; i < _ecs_arr_len(p->sparse); i++)
+        if (p->sparse[i]) p->allocator->free(p->allocator->ctx, p->sparse[i], _ecs_page_size * sizeof **p->sparse);
+
+    _ecs_arr_free(p->allocator, p->sparse);
+    _ecs_arr_free(p->allocator, p->dense);
+    _ecs_arr_free(p->allocator, p->changed);
+    _ecs_arr_free(p->allocator, p->added);
+    _ecs_buf_free(p->allocator, p->data);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// World
 
+typedef struct {
+    int components[16];
+    int count;
+    size_t len;         // The group's entities are dense[0, len) of every owned pool
+} _ecs_group_t;
+
 struct ecs_t {
+    ecs_allocator_t allocator;  // Pools point at this copy
     _ecs_pool_t *pools;
+    _ecs_group_t *groups;
     ecs_id_t *entities;
+    uint32_t tick;
     uint32_t next_idx;
 };
 
-ecs_t *ecs_create(int count, ...) {
-    ecs_t *ecs = calloc(1, sizeof *ecs);
-    if (!ecs) return NULL;
+static ecs_t *_ecs_create(ecs_allocator_t const *allocator, int count, va_list ap) {
+    if (!allocator) allocator = &_ecs_libc;
+    if (!allocator->alloc) return NULL;
 
-    ecs->next_idx = UINT32_MAX;
+    ecs_t *ecs = allocator->alloc(allocator->ctx, sizeof *ecs, _ecs_alignof(ecs_t));
+    if (!ecs) return NULL;
 
-    va_list ap;
-    va_start(ap, count);
+    *ecs = (ecs_t){.allocator = *allocator, .next_idx = UINT32_MAX, .tick = 1};
 
     for (int i = 0; i < count; i++) {
-        _ecs_pool_t p = _ecs_pool_make(va_arg(ap, size_t));
-        _ecs_arr_push(ecs->pools, &p);
+        _ecs_pool_t p = _ecs_pool_make(&ecs->allocator, va_arg(ap, size_t));
+        _ecs_arr_push(&ecs->allocator, ecs->pools, &p);
     }
 
+    return ecs;
+}
+
+ecs_t *ecs_create(int count, ...) {
+    va_list ap;
+    va_start(ap, count);
+    ecs_t *ecs = _ecs_create(NULL, count, ap);
+    va_end(ap);
+    return ecs;
+}
+
+ecs_t *ecs_create_with(ecs_allocator_t const *allocator, int count, ...) {
+    va_list ap;
+    va_start(ap, count);
+    ecs_t *ecs = _ecs_create(allocator, count, ap);
     va_end(ap);
     return ecs;
 }
 
 void ecs_delete(ecs_t *ecs) {
+    ecs_allocator_t allocator = ecs->allocator;
+    if (allocator.release) {
+        allocator.release(allocator.ctx);
+        return;
+    }
+
     for (size_t i = 0; i < _ecs_arr_len(ecs->pools); i++)
         _ecs_pool_free(&ecs->pools[i]);
 
-    _ecs_arr_free(ecs->pools);
-    _ecs_arr_free(ecs->entities);
-    free(ecs);
+    _ecs_arr_free(&allocator, ecs->pools);
+    _ecs_arr_free(&allocator, ecs->groups);
+    _ecs_arr_free(&allocator, ecs->entities);
+    allocator.free(allocator.ctx, ecs, sizeof *ecs);
 }
 
+static void _ecs_group_enter(ecs_t *ecs, _ecs_group_t *g, ecs_id_t e);
+static void _ecs_group_leave(ecs_t *ecs, _ecs_group_t *g, ecs_id_t e);
+
 void ecs_set(ecs_t *ecs, ecs_id_t e, int c, void const *data) {
-    _ecs_pool_set(&ecs->pools[c], e, data);
+    _ecs_pool_t *p = &ecs->pools[c];
+    int added = !_ecs_pool_has(p, e);
+
+    _ecs_pool_set(p, e, data, ecs->tick);
+    if (added && p->group)
+        _ecs_group_enter(ecs, &ecs->groups[p->group - 1], e);
 }
 
 void *ecs_get(ecs_t const *ecs, ecs_id_t e, int c) {
@@ -178,7 +521,12 @@ void *ecs_get(ecs_t const *ecs, ecs_id_t e, int c) {
 }
 
 void ecs_rem(ecs_t *ecs, ecs_id_t e, int c) {
-    _ecs_pool_rem(&ecs->pools[c], e);
+    _ecs_pool_t *p = &ecs->pools[c];
+    if (!_ecs_pool_has(p, e)) return;
+
+    if (p->group)
+        _ecs_group_leave(ecs, &ecs->groups[p->group - 1], e);
+    _ecs_pool_rem(p, e);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -195,32 +543,76 @@ ecs_id_t ecs_spawn(ecs_t *ecs) {
         ecs->entities[idx] = e;
     } else {
         e = _ecs_arr_len(ecs->entities);
-        _ecs_arr_push(ecs->entities, &e);
+        _ecs_arr_push(&ecs->allocator, ecs->entities, &e);
     }
 
     return e;
 }
 
+uint32_t ecs_tick(ecs_t const *ecs) {
+    return ecs->tick;
+}
+
+uint32_t ecs_advance(ecs_t *ecs) {
+    return ++ecs->tick;
+}
+
 void ecs_despawn(ecs_t *ecs, ecs_id_t e) {
-    ecs->entities[_ecs_lo32(e)] = _ecs_mk64(_ecs_lo32(e) + 1, _ecs_lo32(e));
-    ecs->next_idx = _ecs_lo32(e);
+    ecs_despawn_n(ecs, &e, 1);
+}
+
+void ecs_despawn_n(ecs_t *ecs, ecs_id_t const *ids, size_t n) {
+    size_t dead = 0;
+
+    // Leave the groups while the pools still hold the entities, then free their slots: the version goes up and the
+    // index pushed on the free list, so none of the pools' entries for them match `entities` anymore
+    for (size_t i = 0; i < n; i++) {
+        ecs_id_t e = ids[i];
+        uint32_t idx = _ecs_lo32(e);
+        if (idx >= _ecs_arr_len(ecs->entities) || ecs->entities[idx] != e) continue;
+
+        for (size_t g = 0; g < _ecs_arr_len(ecs->groups); g++)
+            _ecs_group_leave(ecs, &ecs->groups[g], e);
+
+        ecs->entities[idx] = _ecs_mk64(_ecs_hi32(e) + 1, ecs->next_idx);
+        ecs->next_idx = idx;
+        dead++;
+    }
+    if (!dead) return;
+
+    for (size_t c = 0; c < _ecs_arr_len(ecs->pools); c++) {
+        _ecs_pool_t *p = &ecs->pools[c];
+        size_t from = p->group ? ecs->groups[p->group - 1].len : 0, len = _ecs_arr_len(p->dense);
+        if (len == from) continue;
+
+        if (dead * 4 < len - from) {
+            for (size_t i = 0; i < n; i++)
+                if (_ecs_pool_has(p, ids[i])) _ecs_pool_rem(p, ids[i]);
+        } else {
+            _ecs_pool_sweep(p, from, ecs->entities);
+        }
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// View
 
 static int _ecs_view_has(ecs_view_t const *v, ecs_id_t e) {
-    for (int i = 0; i < v->count; i++)
-        if (!_ecs_pool_has(v->pools[i], e))
+    int fresh = !v->filter;
+
+    for (int i = 0; i < v->count; i++) {
+        _ecs_pool_t const *p = v->pools[i];
+        if (!_ecs_pool_has(p, e))
             return 0;
-    return 1;
-}
+        if (!fresh)
+            fresh = (v->filter == ECS_ADDED ? p->added : p->changed)[_ecs_sparse(p, e)] > v->since;
+    }
 
-ecs_view_t ecs_query(ecs_t *ecs, int count, ...) {
-    ecs_view_t v = { .count = count };
+    return fresh;
+}
 
-    va_list ap;
-    va_start(ap, count);
+static ecs_view_t _ecs_query(ecs_t *ecs, int filter, uint32_t since, int count, va_list ap) {
+    ecs_view_t v = { .count = count, .entity = UINT64_MAX, .tick = ecs->tick, .since = since, .filter = filter };
 
     for (int i = 0; i < count; i++) {
         int c = va_arg(ap, int);
@@ -230,11 +622,8 @@ ecs_view_t ecs_query(ecs_t *ecs, int count, ...) {
         v.index_to_com[i] = c;
     }
 
-    va_end(ap);
-
-    ecs_id_t *dense = ((_ecs_pool_t *)v.pool)->dense;
-    if (v.pool && _ecs_arr_len(dense) > 0) {
-        v.entity = dense[v.entity_index];
+    if (v.pool && _ecs_arr_len(((_ecs_pool_t *)v.pool)->dense) > 0) {
+        v.entity = ((_ecs_pool_t *)v.pool)->dense[v.entity_index];
         if (!_ecs_view_has(&v, v.entity))
             ecs_next(&v);
     }
@@ -242,6 +631,22 @@ ecs_view_t ecs_query(ecs_t *ecs, int count, ...) {
     return v;
 }
 
+ecs_view_t ecs_query(ecs_t *ecs, int count, ...) {
+    va_list ap;
+    va_start(ap, count);
+    ecs_view_t v = _ecs_query(ecs, 0, 0, count, ap);
+    va_end(ap);
+    return v;
+}
+
+ecs_view_t ecs_query_since(ecs_t *ecs, int filter, uint32_t since, int count, ...) {
+    va_list ap;
+    va_start(ap, count);
+    ecs_view_t v = _ecs_query(ecs, filter, since, count, ap);
+    va_end(ap);
+    return v;
+}
+
 int ecs_valid(ecs_view_t const *v) {
     return v->entity != UINT64_MAX;
 }
@@ -249,7 +654,7 @@ int ecs_valid(ecs_view_t const *v) {
 void ecs_next(ecs_view_t *v) {
     ecs_id_t *dense = ((_ecs_pool_t *)v->pool)->dense;
     do {
-        v->entity = (v->entity_index < _ecs_arr_len(dense)) ? dense[++v->entity_index] : UINT64_MAX;
+        v->entity = (++v->entity_index < _ecs_arr_len(dense)) ? dense[v->entity_index] : UINT64_MAX;
     } while (v->entity != UINT64_MAX && !_ecs_view_has(v, v->entity));
 }
 
@@ -260,4 +665,325 @@ void *ecs_column(ecs_view_t const *v, int c) {
     return NULL;
 }
 
+void *ecs_column_mut(ecs_view_t *v, int c) {
+    for (int i = 0; i < v->count; i++) {
+        if (v->index_to_com[i] != c) continue;
+
+        _ecs_pool_t *p = v->pools[i];
+        p->changed[_ecs_sparse(p, v->entity)] = v->tick;
+        return _ecs_pool_get(p, v->entity);
+    }
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Group
+
+// Moves `e` to the end of the group in every owned pool once it has all of the group's components
+static void _ecs_group_enter(ecs_t *ecs, _ecs_group_t *g, ecs_id_t e) {
+    for (int i = 0; i < g->count; i++)
+        if (!_ecs_pool_has(&ecs->pools[g->components[i]], e))
+            return;
+
+    _ecs_pool_t *first = &ecs->pools[g->components[0]];
+    if (_ecs_sparse(first, e) < g->len) return;
+
+    for (int i = 0; i < g->count; i++) {
+        _ecs_pool_t *p = &ecs->pools[g->components[i]];
+        _ecs_pool_swap(p, _ecs_sparse(p, e), g->len);
+    }
+    g->len++;
+}
+
+// Moves `e` out of the group, before one of its owned components is removed
+static void _ecs_group_leave(ecs_t *ecs, _ecs_group_t *g, ecs_id_t e) {
+    _ecs_pool_t *first = &ecs->pools[g->components[0]];
+    if (!_ecs_pool_has(first, e) || _ecs_sparse(first, e) >= g->len) return;
+
+    g->len--;
+    for (int i = 0; i < g->count; i++) {
+        _ecs_pool_t *p = &ecs->pools[g->components[i]];
+        _ecs_pool_swap(p, _ecs_sparse(p, e), g->len);
+    }
+}
+
+int ecs_group(ecs_t *ecs, int count, ...) {
+    _ecs_group_t g = { .count = count };
+    int id = (int)_ecs_arr_len(ecs->groups);
+    if (count < 1 || count > (int)(sizeof g.components / sizeof *g.components)) return -1;
+
+    // Check every component before any pool is marked as owned
+    va_list ap;
+    va_start(ap, count);
+    for (int i = 0; i < count; i++) {
+        int c = g.components[i] = va_arg(ap, int);
+        int taken = c < 0 || c >= (int)_ecs_arr_len(ecs->pools) || ecs->pools[c].group;
+        for (int j = 0; j < i && !taken; j++)
+            taken = g.components[j] == c;
+        if (taken) {
+            va_end(ap);
+            return -1;
+        }
+    }
+    va_end(ap);
+
+    for (int i = 0; i < count; i++)
+        ecs->pools[g.components[i]].group = id + 1;
+
+    _ecs_arr_push(&ecs->allocator, ecs->groups, &g);
+
+    // Pack the entities that already have every component. Whatever gets swapped down to `len` was already visited.
+    _ecs_pool_t *first = &ecs->pools[g.components[0]];
+    for (size_t i = 0; i < _ecs_arr_len(first->dense); i++)
+        _ecs_group_enter(ecs, &ecs->groups[id], first->dense[i]);
+
+    return id;
+}
+
+size_t ecs_group_count(ecs_t const *ecs, int group) {
+    return ecs->groups[group].len;
+}
+
+ecs_id_t *ecs_group_entities(ecs_t const *ecs, int group) {
+    return ecs->pools[ecs->groups[group].components[0]].dense;
+}
+
+void *ecs_group_column(ecs_t const *ecs, int group, int c) {
+    return ecs->pools[c].group == group + 1 ? ecs->pools[c].data : NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Sort
+
+// Moves the entry at dense position order[i] to i for every i, along the permutation's cycles: n minus the number of
+// cycles swaps, each of them keeping `sparse` up to date. `order` is used up.
+static void _ecs_pool_permute(_ecs_pool_t *p, uint32_t *order) {
+    for (uint32_t i = 0; i < _ecs_arr_len(order); i++) {
+        uint32_t cur = i;
+        for (uint32_t next = order[cur]; next != i; next = order[cur]) {
+            _ecs_pool_swap(p, cur, next);
+            order[cur] = cur;
+            cur = next;
+        }
+        order[cur] = cur;
+    }
+}
+
+typedef struct {
+    _ecs_pool_t const *pool;
+    ecs_cmp_t cmp;
+    void *ctx;
+} _ecs_sort_t;
+
+static int _ecs_sort_less(_ecs_sort_t const *s, uint32_t a, uint32_t b) {
+    ecs_id_t ea = s->pool->dense[a], eb = s->pool->dense[b];
+    if (!s->cmp) return _ecs_lo32(ea) < _ecs_lo32(eb);
+    return s->cmp(ea, _ecs_buf_get(s->pool->data, a, s->pool->stride), eb, _ecs_buf_get(s->pool->data, b, s->pool->stride), s->ctx) < 0;
+}
+
+// Stable bottom-up merge sort of the dense positions in `order`, through `tmp` of the same length
+static void _ecs_sort_order(_ecs_sort_t const *s, uint32_t *order, uint32_t *tmp, size_t n) {
+    for (size_t width = 1; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n, hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi)
+                tmp[k++] = _ecs_sort_less(s, order[j], order[i]) ? order[j++] : order[i++];
+            while (i < mid) tmp[k++] = order[i++];
+            while (j < hi) tmp[k++] = order[j++];
+        }
+        memcpy(order, tmp, n * sizeof *order);
+    }
+}
+
+int ecs_sort(ecs_t *ecs, int c, ecs_cmp_t cmp, void *ctx) {
+    _ecs_pool_t *p = &ecs->pools[c];
+    if (p->group) return -1;
+
+    size_t n = _ecs_arr_len(p->dense);
+    uint32_t *order = NULL, *tmp = NULL;
+    (void)_ecs_arr_addn(&ecs->allocator, order, n);
+    (void)_ecs_arr_addn(&ecs->allocator, tmp, n);
+    for (size_t i = 0; i < n; i++)
+        order[i] = (uint32_t)i;
+
+    _ecs_sort_order(&(_ecs_sort_t){p, cmp, ctx}, order, tmp, n);
+    _ecs_pool_permute(p, order);
+
+    _ecs_arr_free(&ecs->allocator, order);
+    _ecs_arr_free(&ecs->allocator, tmp);
+    return 0;
+}
+
+int ecs_sort_as(ecs_t *ecs, int c, int other) {
+    _ecs_pool_t *p = &ecs->pools[c];
+    _ecs_pool_t const *o = &ecs->pools[other];
+    if (p->group) return -1;
+    if (c == other) return 0;
+
+    // The shared entities in `other`'s order, then the rest as they are
+    size_t n = _ecs_arr_len(p->dense);
+    uint32_t *order = NULL;
+    (void)_ecs_arr_addn(&ecs->allocator, order, n);
+
+    size_t k = 0;
+    for (size_t i = 0; i < _ecs_arr_len(o->dense); i++)
+        if (_ecs_pool_has(p, o->dense[i]))
+            order[k++] = _ecs_sparse(p, o->dense[i]);
+    for (size_t i = 0; i < n; i++)
+        if (!_ecs_pool_has(o, p->dense[i]))
+            order[k++] = (uint32_t)i;
+
+    _ecs_pool_permute(p, order);
+    _ecs_arr_free(&ecs->allocator, order);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Save / Load
+
+// File layout, every block starting on a 64 byte boundary:
+//  header, entities
+//  for each pool: (stride, count), then the dense, data, changed and added arrays
+#define _ecs_save_magic     0x73534345u     // "ECSs"
+#define _ecs_save_version   1
+#define _ecs_save_align(x)  (((x) + 63) & ~(size_t)63)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t pool_count;
+    uint64_t entity_count;
+    uint64_t next_idx;
+    uint64_t tick;
+} _ecs_save_header_t;
+
+// Writes `size` bytes and pads the file up to the next block
+static int _ecs_save_block(FILE *f, void const *data, size_t size) {
+    static char const zero[64];
+    if (size && fwrite(data, size, 1, f) != 1) return 0;
+
+    long pos = ftell(f);
+    if (pos < 0) return 0;
+
+    size_t pad = _ecs_save_align((size_t)pos) - (size_t)pos;
+    return fwrite(zero, 1, pad, f) == pad;
+}
+
+int ecs_save(ecs_t const *ecs, char const *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+
+    _ecs_save_header_t header = {
+        .magic          = _ecs_save_magic,
+        .version        = _ecs_save_version,
+        .pool_count     = _ecs_arr_len(ecs->pools),
+        .entity_count   = _ecs_arr_len(ecs->entities),
+        .next_idx       = ecs->next_idx,
+        .tick           = ecs->tick,
+    };
+    int ok = _ecs_save_block(f, &header, sizeof header);
+    ok &= _ecs_save_block(f, ecs->entities, header.entity_count * sizeof *ecs->entities);
+
+    for (size_t i = 0; i < header.pool_count; i++) {
+        _ecs_pool_t const *p = &ecs->pools[i];
+        uint64_t count = _ecs_arr_len(p->dense);
+
+        ok &= _ecs_save_block(f, (uint64_t[]){p->stride, count}, 2 * sizeof (uint64_t));
+        ok &= _ecs_save_block(f, p->dense, count * sizeof *p->dense);
+        ok &= _ecs_save_block(f, p->data, count * p->stride);
+        ok &= _ecs_save_block(f, p->changed, count * sizeof *p->changed);
+        ok &= _ecs_save_block(f, p->added, count * sizeof *p->added);
+    }
+
+    ok &= !fclose(f);
+    return ok ? 0 : -1;
+}
+
+// Returns the next block of `size` bytes and moves past it, or NULL if the file is too short
+static void *_ecs_load_take(char **at, char const *end, size_t size) {
+    char *p = *at;
+    if (p > end || size > (size_t)(end - p)) return NULL;
+
+    *at = p + _ecs_save_align(size);
+    return p;
+}
+
+// Appends `count` values to a buffer in one copy
+#define _ecs_load_append(a, b, src, count, sz)\
+    ((count) ? memcpy(_ecs_buf_addn(a, b, count, sz), (src), (count) * (sz)) : NULL)
+
+// The whole file at `path` in one malloc block, or NULL
+static char *_ecs_load_file(char const *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    char *data = NULL;
+    long end = fseek(f, 0, SEEK_END) ? -1 : ftell(f);
+    if (end >= (long)sizeof (_ecs_save_header_t) && !fseek(f, 0, SEEK_SET)) {
+        data = malloc((size_t)end);
+        if (data && fread(data, (size_t)end, 1, f) != 1) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(f);
+
+    *size = (size_t)end;
+    return data;
+}
+
+ecs_t *ecs_load(char const *path) {
+    size_t size;
+    char *file = _ecs_load_file(path, &size);
+    if (!file) return NULL;
+
+    char *at = file, *end = file + size;
+    _ecs_save_header_t header = *(_ecs_save_header_t *)_ecs_load_take(&at, end, sizeof header);
+    ecs_id_t *entities = _ecs_load_take(&at, end, header.entity_count * sizeof *entities);
+
+    ecs_t *ecs = NULL;
+    int ok = header.magic == _ecs_save_magic && header.version == _ecs_save_version && entities;
+    if (ok) {
+        ecs = ecs_create(0);
+        ecs->next_idx = (uint32_t)header.next_idx;
+        ecs->tick = (uint32_t)header.tick;
+        _ecs_load_append(&ecs->allocator, ecs->entities, entities, header.entity_count, sizeof *entities);
+    }
+
+    for (size_t i = 0; ok && i < header.pool_count; i++) {
+        uint64_t *head = _ecs_load_take(&at, end, 2 * sizeof (uint64_t));
+        if (!head) { ok = 0; break; }
+
+        uint64_t stride = head[0], count = head[1];
+        ecs_id_t *dense = _ecs_load_take(&at, end, count * sizeof *dense);
+        void *data = _ecs_load_take(&at, end, count * stride);
+        uint32_t *changed = _ecs_load_take(&at, end, count * sizeof *changed);
+        uint32_t *added = _ecs_load_take(&at, end, count * sizeof *added);
+        if (!dense || !data || !changed || !added) { ok = 0; break; }
+
+        _ecs_pool_t p = _ecs_pool_make(&ecs->allocator, stride);
+        _ecs_load_append(p.allocator, p.dense, dense, count, sizeof *dense);
+        _ecs_load_append(p.allocator, p.data, data, count, stride);
+        _ecs_load_append(p.allocator, p.changed, changed, count, sizeof *changed);
+        _ecs_load_append(p.allocator, p.added, added, count, sizeof *added);
+
+        // Only the sparse side has to be rebuilt, one slot per entity
+        for (size_t j = 0; j < count; j++) {
+            _ecs_pool_page(&p, dense[j]);
+            _ecs_sparse(&p, dense[j]) = (uint32_t)j;
+        }
+
+        _ecs_arr_push(&ecs->allocator, ecs->pools, &p);
+    }
+
+    free(file);
+    if (!ok && ecs) {
+        ecs_delete(ecs);
+        ecs = NULL;
+    }
+
+    return ecs;
+}
+
 #endif // ECS_IMPL
\ No newline at end of file
@@ -0,0 +1,27 @@
+///////////////////////////////////////////////////////////////////////////////
+///                                                                         ///
+///                              Test harness                               ///
+///                                                                         ///
+///////////////////////////////////////////////////////////////////////////////
+
+// Shared by test_archetype.c and test_sparse_set.c, which have to be separate executables since both headers define
+// the same ecs_* functions. A failed check is reported and the test carries on, main returns non-zero if any failed.
+
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+
+static int test_failures;
+
+#define test_check(x) do {\
+    if (!(x)) {\
+        fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #x);\
+        test_failures++;\
+    }\
+} while (0)
+
+#define test_run(fn) do {\
+    int before = test_failures;\
+    fn();\
+    printf("%s %s\n", test_failures == before ? "ok  " : "FAIL", #fn);\
+} while (0)
@@ -0,0 +1,1153 @@
+#define ECS_IMPL
+#include "../archetype.h"
+#include "test.h"
+
+typedef struct { int x, y; } pos_t;
+typedef struct { float v[3]; } vel_t;
+typedef struct { int value; } hp_t;
+typedef struct {} empty_t;
+
+// Keys that share their low bits all have the same home slot, so they exercise the probing past it
+static uint64_t map_key(size_t i) {
+    return (uint64_t)i << 20 | 7;
+}
+
+static void test_map(void) {
+    _ecs_map_t m = _ecs_map_make(NULL, sizeof (uint64_t), 0);
+    size_t const n = 5000;
+
+    for (size_t i = 0; i < n; i++)
+        _ecs_map_set(&m, map_key(i), &(uint64_t){i * 3});
+    test_check(m.len == n);
+    test_check(m.cap * 7 >= m.len * 8);
+    for (size_t i = 0; i < n; i++)
+        test_check(_ecs_map_get(&m, map_key(i)) && _ecs_map_get_as(&m, map_key(i), uint64_t) == i * 3);
+    test_check(!_ecs_map_get(&m, map_key(n)));
+
+    // Overwriting keeps one entry
+    _ecs_map_set(&m, map_key(1), &(uint64_t){42});
+    test_check(m.len == n && _ecs_map_get_as(&m, map_key(1), uint64_t) == 42);
+
+    // Removing leaves tombstones that later inserts reuse, and the moved entries are still found
+    for (size_t i = 0; i < n; i += 4)
+        _ecs_map_rem(&m, map_key(i));
+    test_check(m.len == n - (n + 3) / 4);
+    test_check(m.deleted > 0);
+    for (size_t i = 0; i < n; i++)
+        test_check(!_ecs_map_get(&m, map_key(i)) == (i % 4 == 0));
+    test_check(_ecs_map_index(&m, map_key(0)) == -1);
+
+    size_t deleted = m.deleted;
+    for (size_t i = 0; i < n; i += 4)
+        _ecs_map_set(&m, map_key(i), &(uint64_t){i});
+    test_check(m.len == n && m.deleted < deleted);
+    for (size_t i = 0; i < n; i += 4)
+        test_check(_ecs_map_get_as(&m, map_key(i), uint64_t) == i);
+
+    // Growing only rebuilds the slots, the entries keep their index in the packed arrays
+    ptrdiff_t index = _ecs_map_index(&m, map_key(2));
+    for (size_t i = n; i < 4 * n; i++)
+        _ecs_map_set(&m, map_key(i), &(uint64_t){i * 3});
+    test_check(m.len == 4 * n && _ecs_map_index(&m, map_key(2)) == index);
+    test_check(_ecs_map_get_as(&m, map_key(2), uint64_t) == 6);
+    test_check(_ecs_map_index(&m, map_key(4 * n)) == -1);
+
+    // Emptying most of it halves the slots on the way down, shrinking drops the tombstones
+    for (size_t i = 10; i < 4 * n; i++)
+        _ecs_map_rem(&m, map_key(i));
+    _ecs_map_shrink(&m);
+    test_check(m.len == 10 && m.deleted == 0 && m.cap <= 4 * _ecs_map_group);
+    for (size_t i = 0; i < 10; i++)
+        test_check(_ecs_map_get(&m, map_key(i)));
+
+    _ecs_map_free(&m);
+}
+
+static ecs_id_t pos_id;
+static size_t field_rows;
+
+static void field_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    pos_t *p = ecs_field_id(components, pos_id);
+    vel_t *v = ecs_field(components, vel_t);
+    for (size_t i = 0; i < count; i++)
+        p[i].x += (int)v[i].v[0];
+    field_rows += count;
+}
+
+static void test_component_ids(void) {
+    ecs_t *ecs = ecs_create(0);
+    pos_id = ecs_component(ecs, pos_t);
+    ecs_id_t vel_id = ecs_component(ecs, vel_t);
+    test_check(pos_id != vel_id && ecs_component(ecs, pos_t) == pos_id);
+
+    // The handle and the name reach the same component
+    ecs_id_t e = ecs_spawn(ecs);
+    ecs_set_id(ecs, e, pos_id, &(pos_t){1, 2});
+    pos_t *p = ecs_get(ecs, e, pos_t);
+    test_check(p && p->x == 1 && p->y == 2 && ecs_get_id(ecs, e, pos_id) == p);
+    ecs_set(ecs, e, vel_t, {{3, 0, 0}});
+    vel_t *v = ecs_get_id(ecs, e, vel_id);
+    test_check(v && v->v[0] == 3);
+
+    // Setting a component the entity already has overwrites it
+    ecs_set_id(ecs, e, vel_id, &(vel_t){{5, 0, 0}});
+    v = ecs_get_id(ecs, e, vel_id);
+    test_check(v && v->v[0] == 5 && ecs_get(ecs, e, pos_t));
+
+    ecs_id_t system = ecs_register(ecs, field_system, pos_t, vel_t);
+    ecs_run(ecs, system);
+    p = ecs_get_id(ecs, e, pos_id);
+    test_check(field_rows == 1 && p && p->x == 6);
+
+    // Removing a component the entity doesn't have does nothing
+    ecs_rem_id(ecs, e, vel_id);
+    ecs_rem_id(ecs, e, vel_id);
+    test_check(!ecs_get_id(ecs, e, vel_id) && !ecs_get(ecs, e, vel_t));
+    p = ecs_get_id(ecs, e, pos_id);
+    test_check(p && p->x == 6);
+    ecs_rem(ecs, e, pos_t);
+    test_check(!ecs_get_id(ecs, e, pos_id));
+
+    ecs_delete(ecs);
+}
+
+static size_t count_rows;
+
+static void count_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)components, (void)entities;
+    count_rows += count;
+}
+
+static void test_spawn_n(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t ids[3] = {ecs_component(ecs, pos_t), ecs_component(ecs, vel_t), ecs_component(ecs, pos_t)};
+    pos_t data[100];
+    for (int i = 0; i < 100; i++)
+        data[i] = (pos_t){i, -i};
+
+    // pos_t is listed twice but copied once, vel_t has no data and is zeroed
+    ecs_id_t entities[100];
+    ecs_spawn_n(ecs, 100, entities, 3, ids, (void const *[]){data, NULL, data});
+    for (int i = 0; i < 100; i++) {
+        pos_t *p = ecs_get(ecs, entities[i], pos_t);
+        vel_t *v = ecs_get(ecs, entities[i], vel_t);
+        test_check(p && p->x == i && p->y == -i);
+        test_check(v && v->v[0] == 0 && v->v[2] == 0);
+    }
+
+    // Without ids or data, the batch still lands in the same archetype
+    ecs_spawn_n(ecs, 50, NULL, 2, ids, NULL);
+    ecs_id_t e = ecs_spawn(ecs);
+    for (int i = 0; i < 100; i++)
+        test_check(entities[i] != e);
+
+    ecs_id_t system = ecs_register(ecs, count_system, pos_t, vel_t);
+    ecs_run(ecs, system);
+    test_check(count_rows == 150);
+
+    ecs_delete(ecs);
+}
+
+static void test_set_many(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t ids[3] = {ecs_component(ecs, pos_t), ecs_component(ecs, vel_t), ecs_component(ecs, hp_t)};
+    ecs_id_t system = ecs_register(ecs, count_system, pos_t);
+
+    // Components the entity already has keep their values, a NULL entry is zeroed
+    ecs_id_t e = ecs_spawn(ecs);
+    ecs_set(ecs, e, hp_t, {7});
+    ecs_set_many(ecs, e, 2, ids, (void const *[]){&(pos_t){1, 2}, NULL});
+    pos_t *p = ecs_get(ecs, e, pos_t);
+    vel_t *v = ecs_get(ecs, e, vel_t);
+    hp_t *hp = ecs_get(ecs, e, hp_t);
+    test_check(p && p->x == 1 && p->y == 2 && v && v->v[1] == 0 && hp && hp->value == 7);
+
+    // A system made before the archetype existed still finds it
+    count_rows = 0;
+    ecs_run(ecs, system);
+    test_check(count_rows == 1);
+
+    ecs_set_many(ecs, e, 3, ids, (void const *[]){&(pos_t){3, 4}, &(vel_t){{5, 6, 7}}, &(hp_t){8}});
+    p = ecs_get(ecs, e, pos_t);
+    v = ecs_get(ecs, e, vel_t);
+    hp = ecs_get(ecs, e, hp_t);
+    test_check(p && p->x == 3 && v && v->v[2] == 7 && hp && hp->value == 8);
+
+    ecs_rem_many(ecs, e, 2, (ecs_id_t[]){ids[0], ids[2]});
+    test_check(!ecs_get(ecs, e, pos_t) && !ecs_get(ecs, e, hp_t));
+    v = ecs_get(ecs, e, vel_t);
+    test_check(v && v->v[0] == 5);
+    ecs_rem_many(ecs, e, 2, ids);
+    test_check(!ecs_get(ecs, e, vel_t));
+
+    count_rows = 0;
+    ecs_run(ecs, system);
+    test_check(count_rows == 0);
+
+    ecs_delete(ecs);
+}
+
+static _ecs_atomic_size_t whole_rows;   // Atomic with ECS_THREADS
+
+static void range_system(void *components, ecs_id_t *entities, size_t begin, size_t count) {
+    (void)entities;
+    pos_t *p = ecs_field(components, pos_t);
+    for (size_t i = begin; i < begin + count; i++)
+        p[i].y++;
+}
+
+static void whole_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    vel_t *v = ecs_field(components, vel_t);
+    for (size_t i = 0; i < count; i++)
+        v[i].v[0]++;
+    _ecs_atomic_count(&whole_rows, count);
+}
+
+static void test_run_parallel(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_threads(ecs, 4);
+    ecs_id_t ids[10000];
+
+    for (int i = 0; i < 10000; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], pos_t, {i, 0});
+        if (i % 2) ecs_set(ecs, ids[i], vel_t, {{0}});
+    }
+
+    // The two systems write different components, so both can be in flight before the join
+    ecs_id_t range = ecs_register_parallel(ecs, range_system, pos_t);
+    ecs_id_t whole = ecs_register(ecs, whole_system, vel_t);
+    ecs_run_parallel(ecs, range, 100);
+    ecs_run_parallel(ecs, whole, 100);
+    ecs_join(ecs);
+    test_check(_ecs_atomic_load(&whole_rows) == 5000);
+
+    // The default grain, on a pool of another size, and ecs_run with the whole archetype
+    ecs_threads(ecs, 2);
+    ecs_run_parallel(ecs, range, 0);
+    ecs_join(ecs);
+    ecs_run(ecs, range);
+
+    for (int i = 0; i < 10000; i++) {
+        pos_t *p = ecs_get(ecs, ids[i], pos_t);
+        vel_t *v = ecs_get(ecs, ids[i], vel_t);
+        test_check(p && p->x == i && p->y == 3);
+        test_check(!v == !(i % 2) && (!v || v->v[0] == 1));
+    }
+
+    ecs_delete(ecs);
+}
+
+static void double_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    pos_t *p = ecs_field(components, pos_t);
+    for (size_t i = 0; i < count; i++)
+        p[i].x *= 2;
+}
+
+static void inc_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    pos_t *p = ecs_field(components, pos_t);
+    for (size_t i = 0; i < count; i++)
+        p[i].x++;
+}
+
+static void hp_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    vel_t const *v = ecs_field(components, vel_t);
+    hp_t *hp = ecs_field(components, hp_t);
+    for (size_t i = 0; i < count; i++)
+        hp[i].value = (int)v[i].v[0];
+}
+
+static void test_run_all(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_threads(ecs, 4);
+    ecs_id_t ids[1000];
+
+    for (int i = 0; i < 1000; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], pos_t, {i, 0});
+        ecs_set(ecs, ids[i], vel_t, {{0}});
+        ecs_set(ecs, ids[i], hp_t, {-1});
+    }
+
+    // Both pos_t writers keep their order, and hp_system reads vel_t only after whole_system wrote it
+    ecs_register(ecs, double_system, pos_t);
+    ecs_register(ecs, inc_system, pos_t);
+    ecs_register(ecs, whole_system, vel_t);
+    ecs_register(ecs, hp_system, const vel_t, hp_t);
+    ecs_run_all(ecs);
+
+    for (int i = 0; i < 1000; i++) {
+        pos_t *p = ecs_get(ecs, ids[i], pos_t);
+        hp_t *hp = ecs_get(ecs, ids[i], hp_t);
+        test_check(p && p->x == 2 * i + 1 && hp && hp->value == 1);
+    }
+
+    // A system registered later joins the graph after the others
+    ecs_register(ecs, double_system, pos_t);
+    ecs_run_all(ecs);
+
+    for (int i = 0; i < 1000; i++) {
+        pos_t *p = ecs_get(ecs, ids[i], pos_t);
+        hp_t *hp = ecs_get(ecs, ids[i], hp_t);
+        test_check(p && p->x == 2 * ((2 * i + 1) * 2 + 1) && hp && hp->value == 2);
+    }
+
+    ecs_delete(ecs);
+}
+
+static void test_query_cache(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t early = ecs_register(ecs, count_system, pos_t);
+
+    // Archetypes made after the system was registered join its cache, each one once
+    ecs_id_t a = ecs_spawn(ecs), b = ecs_spawn(ecs);
+    ecs_set(ecs, a, pos_t, {0, 0});
+    ecs_set(ecs, a, vel_t, {{0}});
+    ecs_set(ecs, b, vel_t, {{0}});
+    ecs_set(ecs, b, hp_t, {0});
+    count_rows = 0;
+    ecs_run(ecs, early);
+    test_check(count_rows == 1);
+
+    ecs_set(ecs, b, pos_t, {0, 0});
+    ecs_rem(ecs, a, vel_t);
+    count_rows = 0;
+    ecs_run(ecs, early);
+    test_check(count_rows == 2);
+
+    // A system registered later picks up the archetypes that already exist
+    ecs_id_t late = ecs_register(ecs, count_system, vel_t);
+    count_rows = 0;
+    ecs_run(ecs, late);
+    test_check(count_rows == 1);
+
+    ecs_despawn(ecs, b);
+    count_rows = 0;
+    ecs_run(ecs, early);
+    ecs_run(ecs, late);
+    test_check(count_rows == 1);
+
+    ecs_delete(ecs);
+}
+
+static void test_ids(void) {
+    ecs_t *ecs = ecs_create(0);
+
+    ecs_id_t a = ecs_spawn(ecs), b = ecs_spawn(ecs), c = ecs_spawn(ecs);
+    ecs_set(ecs, b, pos_t, {1, 2});
+    test_check(a != b && b != c);
+
+    // A freed index comes back with the next version, and the old id no longer reaches the entity
+    ecs_despawn(ecs, b);
+    test_check(!ecs_get(ecs, b, pos_t));
+    ecs_id_t d = ecs_spawn(ecs);
+    test_check(_ecs_id_idx(d) == _ecs_id_idx(b) && _ecs_id_ver(d) == _ecs_id_ver(b) + 1);
+    test_check(!ecs_get(ecs, d, pos_t));
+
+    ecs_set(ecs, b, pos_t, {3, 4});
+    test_check(!ecs_get(ecs, d, pos_t) && !ecs_get(ecs, b, pos_t));
+
+    // Despawning a stale id again must leave the free list alone
+    ecs_despawn(ecs, b);
+    ecs_despawn(ecs, a);
+    ecs_despawn(ecs, a);
+    ecs_id_t e = ecs_spawn(ecs), f = ecs_spawn(ecs);
+    test_check(_ecs_id_idx(e) == _ecs_id_idx(a) && _ecs_id_ver(e) == _ecs_id_ver(a) + 1);
+    test_check(_ecs_id_idx(f) == 3);
+    test_check(ecs_get(ecs, d, pos_t) == NULL);
+
+    ecs_delete(ecs);
+}
+
+static void test_records(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t ids[300];
+
+    for (int i = 0; i < 300; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], pos_t, {i, i});
+        if (i % 3) ecs_set(ecs, ids[i], hp_t, {i});
+    }
+
+    // Every move and despawn swaps the last row of the archetype into the freed one, whose record has to follow
+    for (int i = 0; i < 300; i += 2)
+        ecs_set(ecs, ids[i], vel_t, {{(float)i}});
+    for (int i = 0; i < 300; i += 5)
+        ecs_despawn(ecs, ids[i]);
+    for (int i = 1; i < 300; i += 7)
+        ecs_rem(ecs, ids[i], pos_t);
+
+    for (int i = 0; i < 300; i++) {
+        pos_t *p = ecs_get(ecs, ids[i], pos_t);
+        vel_t *v = ecs_get(ecs, ids[i], vel_t);
+        hp_t *hp = ecs_get(ecs, ids[i], hp_t);
+        if (i % 5 == 0) {
+            test_check(!p && !v && !hp);
+            continue;
+        }
+
+        test_check((i % 7 == 1) ? !p : p && p->x == i && p->y == i);
+        test_check((i % 2) ? !v : v && v->v[0] == i);
+        test_check((i % 3) ? hp && hp->value == i : !hp);
+    }
+
+    ecs_delete(ecs);
+}
+
+static size_t chunk_calls, chunk_rows, chunk_misaligned;
+
+static void chunk_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    pos_t *p = ecs_field(components, pos_t);
+    vel_t *v = ecs_field(components, vel_t);
+    if ((uintptr_t)p % 64 || (uintptr_t)v % 64) chunk_misaligned++;
+    for (size_t i = 0; i < count; i++)
+        p[i].y += (int)v[i].v[0];
+    chunk_calls++;
+    chunk_rows += count;
+}
+
+static void test_chunks(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t ids[5000];
+
+    ids[0] = ecs_spawn(ecs);
+    ecs_set(ecs, ids[0], pos_t, {0, 0});
+    ecs_set(ecs, ids[0], vel_t, {{1}});
+    pos_t *first = ecs_get(ecs, ids[0], pos_t);
+    for (int i = 1; i < 5000; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], pos_t, {i, 0});
+        ecs_set(ecs, ids[i], vel_t, {{1}});
+    }
+
+    // Fixed-size chunks are added as the archetype grows, so the rows already stored stay where they were
+    test_check(!ECS_CHUNK_SIZE || ecs_get(ecs, ids[0], pos_t) == first);
+    for (int i = 0; i < 5000; i += 3)
+        ecs_despawn(ecs, ids[i]);
+
+    ecs_id_t system = ecs_register(ecs, chunk_system, pos_t, vel_t);
+    ecs_run(ecs, system);
+    test_check(chunk_rows == 3333 && !chunk_misaligned);
+    test_check(ECS_CHUNK_SIZE ? chunk_calls > 1 : chunk_calls == 1);
+
+    for (int i = 0; i < 5000; i++) {
+        pos_t *p = ecs_get(ecs, ids[i], pos_t);
+        test_check(i % 3 == 0 ? !p : p && p->x == i && p->y == 1);
+    }
+
+    ecs_delete(ecs);
+}
+
+static ecs_t *cmd_world;
+
+static void cmd_system(void *components, ecs_id_t *entities, size_t begin, size_t count) {
+    pos_t *p = ecs_field(components, pos_t);
+    for (size_t i = begin; i < begin + count; i++) {
+        if (p[i].x % 2) {
+            ecs_cmd_despawn(cmd_world, entities[i]);
+        } else {
+            ecs_cmd_set(cmd_world, entities[i], vel_t, {{(float)p[i].x}});
+            ecs_cmd_set(cmd_world, ecs_cmd_spawn(cmd_world), hp_t, {p[i].x});
+        }
+    }
+}
+
+static void test_flush(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t tag = ecs_tag(ecs, Frozen);
+
+    // The values land in the order they were recorded, and only the final archetype gets made
+    size_t archetypes = ecs_stats(ecs).archetypes;
+    ecs_id_t a = ecs_cmd_spawn(ecs);
+    ecs_cmd_set(ecs, a, pos_t, {1, 1});
+    ecs_cmd_set(ecs, a, vel_t, {{1, 2, 3}});
+    ecs_cmd_set_id(ecs, a, tag, NULL);
+    ecs_cmd_set(ecs, a, pos_t, {2, 2});
+    ecs_cmd_rem(ecs, a, vel_t);
+
+    // ecs_spawn between ecs_cmd_spawn and the flush gets an id of its own
+    ecs_id_t b = ecs_spawn(ecs);
+    ecs_set(ecs, b, vel_t, {{4, 5, 6}});
+    ecs_id_t c = ecs_cmd_spawn(ecs);
+    test_check(a != b && b != c && a != c);
+
+    ecs_cmd_rem(ecs, b, vel_t);
+    ecs_cmd_set(ecs, b, vel_t, {{7, 8, 9}});
+    ecs_cmd_set(ecs, c, pos_t, {3, 3});
+    ecs_cmd_despawn(ecs, c);
+    ecs_cmd_set(ecs, c, vel_t, {{0, 0, 0}});
+    ecs_flush(ecs);
+
+    pos_t *p = ecs_get(ecs, a, pos_t);
+    test_check(p && p->x == 2 && !ecs_get(ecs, a, vel_t) && ecs_has_id(ecs, a, tag));
+    vel_t *v = ecs_get(ecs, b, vel_t);
+    test_check(v && v->v[0] == 7 && v->v[2] == 9);
+    test_check(!ecs_get(ecs, c, pos_t) && !ecs_get(ecs, c, vel_t));
+    test_check(ecs_stats(ecs).archetypes == archetypes + 2);
+
+    ecs_delete(ecs);
+}
+
+static void test_reserved(void) {
+    ecs_t *ecs = ecs_create(0);
+
+    // a has a slot once ecs_spawn claims it, c doesn't, and neither is alive before the flush
+    ecs_id_t a = ecs_cmd_spawn(ecs);
+    ecs_cmd_set(ecs, a, pos_t, {1, 1});
+    ecs_id_t b = ecs_spawn(ecs);
+    ecs_id_t c = ecs_cmd_spawn(ecs);
+
+    ecs_id_t reserved[2] = {a, c};
+    for (int i = 0; i < 2; i++) {
+        ecs_id_t e = reserved[i];
+        ecs_set(ecs, e, vel_t, {{1}});
+        test_check(!ecs_get(ecs, e, pos_t) && !ecs_get(ecs, e, vel_t) && !ecs_has(ecs, e, vel_t));
+        ecs_rem(ecs, e, pos_t);
+        ecs_set_parent(ecs, e, b);
+        ecs_despawn(ecs, e);
+    }
+
+    // The flush still spawns both, with only what was recorded for them
+    ecs_flush(ecs);
+    pos_t *p = ecs_get(ecs, a, pos_t);
+    test_check(p && p->x == 1 && !ecs_get(ecs, a, vel_t) && ecs_parent(ecs, a) == ECS_NONE);
+    ecs_set(ecs, c, hp_t, {3});
+    hp_t *hp = ecs_get(ecs, c, hp_t);
+    test_check(hp && hp->value == 3 && !ecs_get(ecs, c, pos_t));
+    ecs_despawn(ecs, c);
+    test_check(!ecs_get(ecs, c, hp_t) && ecs_stats(ecs).entities == 2);
+
+    ecs_delete(ecs);
+}
+
+static void test_cmd_parallel(void) {
+    ecs_t *ecs = cmd_world = ecs_create(0);
+    ecs_threads(ecs, 4);
+    ecs_id_t ids[2000];
+
+    for (int i = 0; i < 2000; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], pos_t, {i, 0});
+    }
+
+    // Every thread records into its own buffer, and ecs_join applies them all
+    ecs_id_t system = ecs_register_parallel(ecs, cmd_system, pos_t);
+    ecs_run_parallel(ecs, system, 64);
+    ecs_join(ecs);
+
+    for (int i = 0; i < 2000; i++) {
+        vel_t *v = ecs_get(ecs, ids[i], vel_t);
+        test_check(i % 2 ? !ecs_get(ecs, ids[i], pos_t) : v && v->v[0] == i);
+    }
+
+    count_rows = 0;
+    ecs_id_t spawned = ecs_register(ecs, count_system, hp_t);
+    ecs_run(ecs, spawned);
+    test_check(count_rows == 1000);
+
+    ecs_delete(ecs);
+}
+
+static size_t since_rows(ecs_t *ecs, ecs_id_t system, ecs_id_t component, int filter, uint32_t since) {
+    count_rows = 0;
+    ecs_run_since(ecs, system, component, filter, since);
+    return count_rows;
+}
+
+static void test_ticks(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t pos_id = ecs_component(ecs, pos_t), vel_id = ecs_component(ecs, vel_t);
+    ecs_id_t hp_id = ecs_component(ecs, hp_t);
+    ecs_id_t reader = ecs_register(ecs, count_system, const pos_t);
+    ecs_id_t writer = ecs_register(ecs, inc_system, pos_t);
+    test_check(ecs_tick(ecs) == 1);
+
+    ecs_id_t a = ecs_spawn(ecs), b = ecs_spawn(ecs);
+    ecs_set(ecs, a, pos_t, {0, 0});
+    ecs_set(ecs, a, vel_t, {{0}});
+    ecs_set(ecs, b, pos_t, {0, 0});
+
+    // Nothing is newer than the current tick until something is written after the world moves on
+    test_check(ecs_advance(ecs) == 2 && ecs_tick(ecs) == 2);
+    test_check(since_rows(ecs, reader, pos_id, ECS_CHANGED, 0) == 2);
+    test_check(since_rows(ecs, reader, pos_id, ECS_CHANGED, 1) == 0);
+
+    ecs_set(ecs, a, vel_t, {{1}});
+    test_check(since_rows(ecs, reader, vel_id, ECS_CHANGED, 1) == 1);
+    test_check(since_rows(ecs, reader, vel_id, ECS_ADDED, 1) == 0);
+    test_check(since_rows(ecs, reader, pos_id, ECS_CHANGED, 1) == 0);
+
+    // Moving b stamps the column it gained as added
+    ecs_advance(ecs);
+    ecs_set(ecs, b, hp_t, {0});
+    test_check(since_rows(ecs, reader, hp_id, ECS_ADDED, 2) == 1);
+    test_check(since_rows(ecs, reader, pos_id, ECS_ADDED, 2) == 0);
+
+    // Running a system that doesn't declare pos_t const counts as writing it, the const reader doesn't
+    ecs_advance(ecs);
+    ecs_run(ecs, reader);
+    test_check(since_rows(ecs, reader, pos_id, ECS_CHANGED, 3) == 0);
+    ecs_run(ecs, writer);
+    test_check(since_rows(ecs, reader, pos_id, ECS_CHANGED, 3) == 2);
+    test_check(since_rows(ecs, reader, vel_id, ECS_CHANGED, 3) == 0);
+
+    ecs_delete(ecs);
+}
+
+// Saves `size` bytes of `data` with the 8 at `offset` replaced by `value`, and loads them back in both modes. Returns
+// whether either load made a world.
+static int load_patched(char const *data, size_t size, size_t offset, uint64_t value) {
+    FILE *f = fopen("test_archetype.ecs", "wb");
+    fwrite(data, 1, offset, f);
+    fwrite(&value, sizeof value, 1, f);
+    fwrite(data + offset + sizeof value, 1, size - offset - sizeof value, f);
+    fclose(f);
+
+    int loaded = 0;
+    for (int mode = 0; mode < 2; mode++) {
+        ecs_t *ecs = ecs_load("test_archetype.ecs", mode ? ECS_LOAD_MMAP : 0);
+        loaded |= ecs != NULL;
+        if (ecs) ecs_delete(ecs);
+    }
+    return loaded;
+}
+
+static void test_save_load(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t ids[200];
+
+    for (int i = 0; i < 200; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], pos_t, {i, -i});
+        if (i % 2) ecs_set(ecs, ids[i], vel_t, {{i, 0, 1}});
+        if (i % 3 == 0) ecs_add(ecs, ids[i], Frozen);
+        if (i % 10) ecs_set_parent(ecs, ids[i], ids[i / 10 * 10]);
+    }
+    for (int i = 5; i < 200; i += 50)
+        ecs_despawn(ecs, ids[i]);
+    ecs_advance(ecs);
+    test_check(!ecs_save(ecs, "test_archetype.ecs"));
+
+    for (int mode = 0; mode < 2; mode++) {
+        ecs_t *loaded = ecs_load("test_archetype.ecs", mode ? ECS_LOAD_MMAP : 0);
+        test_check(loaded);
+        if (!loaded) continue;
+
+        test_check(ecs_tick(loaded) == 2);
+        for (int i = 0; i < 200; i++) {
+            pos_t *p = ecs_get(loaded, ids[i], pos_t);
+            if (i % 50 == 5) {
+                test_check(!p);
+                continue;
+            }
+
+            test_check(p && p->x == i && p->y == -i);
+            vel_t *v = ecs_get(loaded, ids[i], vel_t);
+            test_check(!v == !(i % 2) && (!v || v->v[0] == i));
+            test_check(ecs_has(loaded, ids[i], Frozen) == (i % 3 == 0));
+            test_check(ecs_parent(loaded, ids[i]) == (i % 10 ? ids[i / 10 * 10] : ECS_NONE));
+            test_check(ecs_depth(loaded, ids[i]) == (i % 10 != 0));
+        }
+
+        // The free list survives, and the loaded world can still change
+        ecs_id_t e = ecs_spawn(loaded);
+        test_check(_ecs_id_idx(e) % 50 == 5 && _ecs_id_ver(e) == 1);
+        ecs_set(loaded, ids[0], vel_t, {{9, 9, 9}});
+        test_check(((vel_t *)ecs_get(loaded, ids[0], vel_t))->v[1] == 9);
+        test_check(((pos_t *)ecs_get(loaded, ids[0], pos_t))->x == 0);
+
+        ecs_delete(loaded);
+    }
+
+    // Counts and indices that don't fit the file or the ids in it fail the load instead of being trusted
+    FILE *f = fopen("test_archetype.ecs", "rb");
+    char *data = malloc(1 << 20);
+    size_t size = fread(data, 1, 1 << 20, f);
+    fclose(f);
+
+    _ecs_save_header_t header;
+    memcpy(&header, data, sizeof header);
+    size_t components = sizeof header;
+    size_t id_at = _ecs_align(components + header.component_count * 16, _ecs_column_align);
+    size_t node_at = _ecs_align(id_at + header.id_count * sizeof (ecs_id_t), _ecs_column_align);
+    size_t archetype_at = _ecs_align(node_at + header.node_count * sizeof (_ecs_node_t), _ecs_column_align);
+
+    test_check(load_patched(data, size, 0, *(uint64_t *)data));
+    test_check(!load_patched(data, size, offsetof(_ecs_save_header_t, archetype_count), header.archetype_count + 1));
+    test_check(!load_patched(data, size, offsetof(_ecs_save_header_t, id_count), (uint64_t)1 << 61));
+    test_check(!load_patched(data, size, offsetof(_ecs_save_header_t, next_idx), _ecs_id_idx(ids[0])));
+    test_check(!load_patched(data, size, components + 8, (uint64_t)1 << 62));
+    test_check(!load_patched(data, size, node_at + sizeof (_ecs_node_t), header.id_count));
+    test_check(!load_patched(data, size, archetype_at + 16, (uint64_t)1 << 60));
+    free(data);
+
+    // Neither a missing file nor one that isn't a saved world loads
+    test_check(!ecs_load("test_missing.ecs", 0));
+    f = fopen("test_archetype.ecs", "wb");
+    fputs("not a world", f);
+    fclose(f);
+    test_check(!ecs_load("test_archetype.ecs", 0) && !ecs_load("test_archetype.ecs", ECS_LOAD_MMAP));
+
+    remove("test_archetype.ecs");
+    ecs_delete(ecs);
+}
+
+static void test_stats(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t system = ecs_register(ecs, count_system, pos_t);
+
+    for (int i = 0; i < 100; i++) {
+        ecs_id_t e = ecs_spawn(ecs);
+        ecs_set(ecs, e, pos_t, {i, i});
+        if (i % 2) ecs_set(ecs, e, vel_t, {{0}});
+    }
+
+    // The root, pos_t and pos_t + vel_t
+    ecs_stats_t stats = ecs_stats(ecs);
+    test_check(stats.archetypes == 3 && stats.entities == 100 && stats.column_bytes > 0);
+
+    ecs_archetype_stats_t archetypes[3];
+    test_check(ecs_stats_archetypes(ecs, NULL, 0) == 3 && ecs_stats_archetypes(ecs, archetypes, 3) == 3);
+    size_t rows = 0;
+    for (int i = 0; i < 3; i++) {
+        rows += archetypes[i].rows;
+        test_check(archetypes[i].capacity >= archetypes[i].rows);
+        if (archetypes[i].columns != 2) continue;
+
+        ecs_column_stats_t columns[2];
+        test_check(archetypes[i].rows == 50);
+        test_check(ecs_stats_columns(ecs, i, columns, 2) == 2);
+        test_check(columns[0].stride + columns[1].stride == sizeof (pos_t) + sizeof (vel_t));
+    }
+    test_check(rows == 100);
+
+    ecs_run(ecs, system);
+    ecs_system_stats_t system_stats = ecs_stats_system(ecs, system);
+#if defined(ECS_STATS)
+    test_check(stats.transfers == 150 && stats.map_lookups > 0);
+    test_check(system_stats.runs == 1 && system_stats.entities == 100);
+#else
+    test_check(stats.transfers == 0 && stats.map_lookups == 0);
+    test_check(system_stats.runs == 0 && system_stats.entities == 0);
+#endif
+
+    ecs_stats_reset(ecs);
+    test_check(ecs_stats(ecs).transfers == 0 && ecs_stats_system(ecs, system).runs == 0);
+
+    // Another world's work and resets don't show up in this one's map counters
+    ecs_t *other = ecs_create(0);
+    ecs_set(other, ecs_spawn(other), pos_t, {0, 0});
+    test_check(ecs_stats(ecs).map_lookups == 0);
+    ecs_component(ecs, pos_t);
+    size_t lookups = ecs_stats(ecs).map_lookups;
+    ecs_stats_reset(other);
+#if defined(ECS_STATS)
+    test_check(lookups > 0 && ecs_stats(ecs).map_lookups == lookups);
+#else
+    test_check(lookups == 0);
+#endif
+    ecs_delete(other);
+
+    // The trace is a JSON array, whether or not there are slices to put in it
+    test_check(!ecs_trace_begin(ecs, "test_archetype.json"));
+    ecs_run(ecs, system);
+    ecs_trace_frame(ecs);
+    ecs_trace_end(ecs);
+
+    char trace[4096] = {0};
+    FILE *f = fopen("test_archetype.json", "r");
+    test_check(f && fread(trace, 1, sizeof trace - 1, f) > 0);
+    if (f) fclose(f);
+    size_t len = strlen(trace);
+    test_check(trace[0] == '[' && len && trace[len - 1 - (trace[len - 1] == '\n')] == ']');
+    test_check(strstr(trace, "\"entities\":100"));
+    remove("test_archetype.json");
+
+    ecs_delete(ecs);
+}
+
+static void test_identity(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t pos_id = ecs_component(ecs, pos_t), vel_id = ecs_component(ecs, vel_t);
+
+    // The same components added in either order end up in the same archetype
+    ecs_id_t a = ecs_spawn(ecs), b = ecs_spawn(ecs);
+    ecs_set(ecs, a, pos_t, {1, 1});
+    ecs_set(ecs, a, vel_t, {{1}});
+    ecs_set(ecs, b, vel_t, {{2}});
+    ecs_set(ecs, b, pos_t, {2, 2});
+    test_check(ecs_stats(ecs).archetypes == 4);
+
+    // A single component whose id is the XOR of the other two hashes the same but gets its own archetype
+    ecs_id_t collides = pos_id ^ vel_id;
+    _ecs_map_set(&ecs->components, collides, &(size_t){sizeof (int)});
+    ecs_id_t c = ecs_spawn(ecs);
+    ecs_set_id(ecs, c, collides, &(int){3});
+    test_check(ecs_stats(ecs).archetypes == 5);
+    test_check(!ecs_get(ecs, c, pos_t) && *(int *)ecs_get_id(ecs, c, collides) == 3);
+    test_check(!ecs_get_id(ecs, a, collides) && ((pos_t *)ecs_get(ecs, a, pos_t))->x == 1);
+
+    // Going back and forth over the cached edges makes no new archetypes
+    for (int i = 0; i < 100; i++) {
+        ecs_rem(ecs, b, vel_t);
+        ecs_set(ecs, b, vel_t, {{(float)i}});
+    }
+    vel_t *v = ecs_get(ecs, b, vel_t);
+    test_check(v && v->v[0] == 99 && ((pos_t *)ecs_get(ecs, b, pos_t))->x == 2);
+    test_check(ecs_stats(ecs).archetypes == 5);
+
+    ecs_delete(ecs);
+}
+
+// Wraps malloc and keeps count of what the world still holds, which has to be nothing once it is deleted
+typedef struct {
+    long blocks, bytes;
+} counter_t;
+
+static void *counting_alloc(void *ctx, size_t size, size_t align) {
+    counter_t *counter = ctx;
+    void *ptr = _ecs_libc.alloc(NULL, size, align);
+    if (ptr) counter->blocks++, counter->bytes += (long)size;
+    return ptr;
+}
+
+static void *counting_realloc(void *ctx, void *ptr, size_t old_size, size_t size) {
+    counter_t *counter = ctx;
+    void *next = _ecs_libc.realloc(NULL, ptr, old_size, size);
+    if (next) counter->blocks += !ptr, counter->bytes += (long)size - (long)old_size;
+    return next;
+}
+
+static void counting_free(void *ctx, void *ptr, size_t size) {
+    counter_t *counter = ctx;
+    if (ptr) counter->blocks--, counter->bytes -= (long)size;
+    _ecs_libc.free(NULL, ptr, size);
+}
+
+static void test_allocators(void) {
+    counter_t counter = {0};
+    ecs_allocator_t counting = {counting_alloc, counting_realloc, counting_free, NULL, &counter};
+    ecs_allocator_t arena = ecs_arena(4096);
+
+    for (int pass = 0; pass < 2; pass++) {
+        ecs_t *ecs = ecs_create_with(0, pass ? &arena : &counting);
+        ecs_id_t system = ecs_register(ecs, count_system, pos_t);
+        ecs_id_t ids[3000];
+
+        // Moves release columns to the world's free lists and new ones take them back
+        for (int i = 0; i < 3000; i++) {
+            ids[i] = ecs_spawn(ecs);
+            ecs_set(ecs, ids[i], pos_t, {i, i});
+            if (i % 2) ecs_set(ecs, ids[i], vel_t, {{(float)i}});
+            if (i % 3) ecs_set(ecs, ids[i], hp_t, {i});
+        }
+        for (int i = 0; i < 3000; i += 4)
+            ecs_rem(ecs, ids[i], pos_t);
+        for (int i = 0; i < 3000; i += 5)
+            ecs_despawn(ecs, ids[i]);
+
+        count_rows = 0;
+        ecs_run(ecs, system);
+        test_check(count_rows == 3000 - 750 - 600 + 150);
+        for (int i = 1; i < 3000; i += 10) {
+            pos_t *p = ecs_get(ecs, ids[i], pos_t);
+            vel_t *v = ecs_get(ecs, ids[i], vel_t);
+            test_check(p && p->x == i && v && v->v[0] == i);
+        }
+
+        ecs_delete(ecs);
+    }
+
+    test_check(counter.blocks == 0 && counter.bytes == 0);
+
+    // What ecs_arena returns when it runs out of memory is turned down instead of called
+    ecs_allocator_t failed = {0};
+    test_check(!ecs_create_with(0, &failed));
+}
+
+static void test_compact(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t system = ecs_register(ecs, count_system, pos_t);
+    ecs_id_t ids[100];
+
+    for (int i = 0; i < 100; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], pos_t, {i, i});
+        if (i % 2) ecs_set(ecs, ids[i], vel_t, {{0}});
+        if (i % 2) ecs_set(ecs, ids[i], hp_t, {i});
+    }
+    for (int i = 1; i < 100; i += 2)
+        ecs_rem_many(ecs, ids[i], 2, (ecs_id_t[]){ecs_component(ecs, vel_t), ecs_component(ecs, hp_t)});
+
+    // pos_t + vel_t and pos_t + vel_t + hp_t are empty, the root stays even though it is too
+    size_t archetypes = ecs_stats(ecs).archetypes;
+    test_check(ecs_compact(ecs) == 2 && ecs_stats(ecs).archetypes == archetypes - 2);
+    test_check(ecs_compact(ecs) == 0);
+
+    count_rows = 0;
+    ecs_run(ecs, system);
+    test_check(count_rows == 100);
+
+    // The edges to the freed archetypes went with them, so adding the components again makes new ones
+    ecs_set(ecs, ids[1], vel_t, {{1}});
+    ecs_set(ecs, ids[1], hp_t, {1});
+    test_check(ecs_stats(ecs).archetypes == archetypes);
+    for (int i = 0; i < 100; i++) {
+        pos_t *p = ecs_get(ecs, ids[i], pos_t);
+        test_check(p && p->x == i && !ecs_get(ecs, ids[i], vel_t) == (i != 1));
+    }
+
+    // Capacity the rows don't need anymore goes back, and pos_t + vel_t, which ids[1] only went through, is freed
+    ecs_id_t many[5000];
+    for (int i = 0; i < 5000; i++) {
+        many[i] = ecs_spawn(ecs);
+        ecs_set(ecs, many[i], hp_t, {i});
+    }
+    for (int i = 100; i < 5000; i++)
+        ecs_despawn(ecs, many[i]);
+    size_t bytes = ecs_stats(ecs).column_bytes;
+    test_check(ecs_compact(ecs) == 1 && ecs_stats(ecs).column_bytes < bytes);
+    for (int i = 0; i < 100; i++)
+        test_check(((hp_t *)ecs_get(ecs, many[i], hp_t))->value == i);
+
+    // In slices, each call looking at one archetype: hp_t and pos_t + vel_t + hp_t are empty now
+    for (int i = 0; i < 100; i++)
+        ecs_despawn(ecs, many[i]);
+    ecs_rem_many(ecs, ids[1], 2, (ecs_id_t[]){ecs_component(ecs, vel_t), ecs_component(ecs, hp_t)});
+    size_t freed = 0, calls = 0;
+    archetypes = ecs_stats(ecs).archetypes;
+    while (calls++ < archetypes)
+        freed += ecs_compact_step(ecs, 1);
+    test_check(freed == 2 && ecs_stats(ecs).archetypes == archetypes - 2);
+
+    count_rows = 0;
+    ecs_run(ecs, system);
+    test_check(count_rows == 100);
+
+    ecs_delete(ecs);
+}
+
+static ecs_t *tree_world;
+
+// World position: the parent's, which ecs_run already updated since it sits at a lower depth, plus the local one
+static void propagate_system(void *components, ecs_id_t *entities, size_t count) {
+    pos_t *p = ecs_field(components, pos_t);
+    for (size_t i = 0; i < count; i++) {
+        ecs_id_t parent = ecs_parent(tree_world, entities[i]);
+        pos_t *parent_pos = parent != ECS_NONE ? ecs_get(tree_world, parent, pos_t) : NULL;
+        p[i].y = p[i].x + (parent_pos ? parent_pos->y : 0);
+    }
+}
+
+static void test_hierarchy(void) {
+    ecs_t *ecs = tree_world = ecs_create(0);
+    ecs_id_t system = ecs_register(ecs, propagate_system, pos_t);
+
+    // Made leaf first, so creation order is the opposite of depth order
+    ecs_id_t g = ecs_spawn(ecs), c1 = ecs_spawn(ecs), c2 = ecs_spawn(ecs), r = ecs_spawn(ecs);
+    ecs_set(ecs, g, pos_t, {100, 0});
+    ecs_set(ecs, c1, pos_t, {10, 0});
+    ecs_set(ecs, c2, pos_t, {20, 0});
+    ecs_set(ecs, r, pos_t, {1, 0});
+    ecs_set_parent(ecs, g, c1);
+    ecs_set_parent(ecs, c1, r);
+    ecs_set_parent(ecs, c2, r);
+
+    test_check(ecs_parent(ecs, g) == c1 && ecs_parent(ecs, c1) == r && ecs_parent(ecs, r) == ECS_NONE);
+    test_check(ecs_depth(ecs, r) == 0 && ecs_depth(ecs, c1) == 1 && ecs_depth(ecs, c2) == 1 && ecs_depth(ecs, g) == 2);
+    test_check(ecs_first_child(ecs, r) == c2 && ecs_next_sibling(ecs, c2) == c1);
+    test_check(ecs_next_sibling(ecs, c1) == ECS_NONE && ecs_first_child(ecs, g) == ECS_NONE);
+
+    ecs_run(ecs, system);
+    test_check(((pos_t *)ecs_get(ecs, g, pos_t))->y == 111 && ((pos_t *)ecs_get(ecs, c2, pos_t))->y == 21);
+
+    // Cycles are refused, moving a subtree moves its depths along
+    ecs_set_parent(ecs, r, g);
+    test_check(ecs_parent(ecs, r) == ECS_NONE);
+    ecs_set_parent(ecs, c1, c2);
+    test_check(ecs_depth(ecs, c1) == 2 && ecs_depth(ecs, g) == 3 && ecs_first_child(ecs, r) == c2);
+    ecs_run(ecs, system);
+    test_check(((pos_t *)ecs_get(ecs, g, pos_t))->y == 131);
+    ecs_set_parent(ecs, c1, ECS_NONE);
+    test_check(ecs_depth(ecs, c1) == 0 && ecs_depth(ecs, g) == 1 && ecs_first_child(ecs, c2) == ECS_NONE);
+
+    // Despawning takes the descendants along, however deep they go
+    ecs_set_parent(ecs, c1, r);
+    ecs_id_t chain = g;
+    for (int i = 0; i < 10000; i++) {
+        ecs_id_t e = ecs_spawn(ecs);
+        ecs_set_parent(ecs, e, chain);
+        chain = e;
+    }
+    test_check(ecs_depth(ecs, chain) == 10002);
+    ecs_despawn(ecs, r);
+    test_check(!ecs_get(ecs, r, pos_t) && !ecs_get(ecs, c1, pos_t) && !ecs_get(ecs, c2, pos_t));
+    test_check(!ecs_get(ecs, g, pos_t) && ecs_depth(ecs, chain) == 0 && ecs_parent(ecs, chain) == ECS_NONE);
+    test_check(ecs_stats(ecs).entities == 0);
+
+    ecs_delete(ecs);
+}
+
+static void test_tags(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t frozen = ecs_tag(ecs, Frozen);
+    ecs_id_t system = ecs_register(ecs, count_system, pos_t, Frozen);
+    ecs_id_t ids[100];
+
+    for (int i = 0; i < 100; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], pos_t, {i, i});
+        if (i % 3 == 0) ecs_add(ecs, ids[i], Frozen);
+    }
+
+    // A tag moves the entity like any component but has no column
+    count_rows = 0;
+    ecs_run(ecs, system);
+    test_check(count_rows == 34);
+    for (int i = 0; i < 100; i++) {
+        pos_t *p = ecs_get(ecs, ids[i], pos_t);
+        test_check(p && p->x == i && ecs_has(ecs, ids[i], pos_t));
+        test_check(ecs_has(ecs, ids[i], Frozen) == (i % 3 == 0) && ecs_has_id(ecs, ids[i], frozen) == (i % 3 == 0));
+    }
+
+    ecs_archetype_stats_t archetypes[8];
+    size_t count = ecs_stats_archetypes(ecs, archetypes, 8);
+    for (size_t i = 0; i < count && i < 8; i++)
+        test_check(archetypes[i].columns <= 1);
+
+    ecs_rem(ecs, ids[0], Frozen);
+    test_check(!ecs_has(ecs, ids[0], Frozen) && ((pos_t *)ecs_get(ecs, ids[0], pos_t))->x == 0);
+
+    // An empty struct is a tag too
+    ecs_set(ecs, ids[1], empty_t, {});
+    test_check(ecs_has(ecs, ids[1], empty_t) && !ecs_has(ecs, ids[2], empty_t));
+
+    // More components than one signature word holds
+    char name[16];
+    ecs_id_t many[70];
+    for (int i = 0; i < 70; i++) {
+        snprintf(name, sizeof name, "tag%d", i);
+        many[i] = _ecs_component(ecs, name, 0);
+    }
+    ecs_set_many(ecs, ids[2], 70, many, NULL);
+    ecs_id_t last = ecs_register(ecs, count_system, tag69);
+    count_rows = 0;
+    ecs_run(ecs, last);
+    test_check(count_rows == 1 && ecs_has_id(ecs, ids[2], many[69]) && !ecs_has_id(ecs, ids[3], many[69]));
+
+    ecs_delete(ecs);
+}
+
+typedef struct { float v[3]; } acc_t;
+
+static ecs_id_t acc_id;
+static size_t simd_misaligned;
+
+static void fill_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    acc_t *a = ecs_field_aligned(components, acc_t);
+    if ((uintptr_t)a % ECS_ALIGN) simd_misaligned++;
+    ecs_fill_f32(a->v, 2, 3 * count);
+}
+
+static void axpy_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    vel_t *v = ecs_field_aligned(components, vel_t);
+    acc_t const *a = ecs_field_id_aligned(components, acc_id, acc_t);
+    if ((uintptr_t)v % ECS_ALIGN || (uintptr_t)a % ECS_ALIGN) simd_misaligned++;
+    ecs_axpy_f32(v->v, a->v, 0.5f, 3 * count);
+}
+
+static void copy_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    ecs_copy_f32(ecs_field_aligned(components, acc_t)->v, ecs_field_aligned(components, vel_t)->v, 3 * count);
+}
+
+static void test_aligned(void) {
+    test_check(ecs_padded(16, float) == 16 && ecs_padded(17, float) == 32 && ecs_padded(3, vel_t) == 5);
+
+    ecs_t *ecs = ecs_create(0);
+    acc_id = ecs_component(ecs, acc_t);
+    ecs_id_t ids[1001];
+
+    // An odd count, so the kernels run into the padding after the last row
+    for (int i = 0; i < 1001; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], vel_t, {{i, i, i}});
+        ecs_set(ecs, ids[i], acc_t, {{0}});
+        ecs_set(ecs, ids[i], pos_t, {i, i});
+    }
+
+    ecs_run(ecs, ecs_register(ecs, fill_system, acc_t));
+    ecs_run(ecs, ecs_register(ecs, axpy_system, vel_t, const acc_t));
+    ecs_run(ecs, ecs_register(ecs, copy_system, acc_t, const vel_t));
+    test_check(!simd_misaligned);
+
+    for (int i = 0; i < 1001; i++) {
+        vel_t *v = ecs_get(ecs, ids[i], vel_t);
+        acc_t *a = ecs_get(ecs, ids[i], acc_t);
+        pos_t *p = ecs_get(ecs, ids[i], pos_t);
+        test_check(v && v->v[0] == i + 1 && v->v[2] == i + 1);
+        test_check(a && a->v[1] == i + 1 && p && p->x == i && p->y == i);
+    }
+
+    ecs_delete(ecs);
+}
+
+static size_t term_rows, term_missing;
+
+static void term_system(void *components, ecs_id_t *entities, size_t count) {
+    (void)entities;
+    term_rows += count;
+    if (!ecs_field(components, vel_t)) term_missing += count;
+}
+
+static void test_query_terms(void) {
+    ecs_t *ecs = ecs_create(0);
+    ecs_id_t system = ecs_register(ecs, term_system, pos_t, !Frozen, const ?vel_t);
+
+    for (int i = 0; i < 100; i++) {
+        ecs_id_t e = ecs_spawn(ecs);
+        ecs_set(ecs, e, pos_t, {i, i});
+        if (i % 2) ecs_set(ecs, e, vel_t, {{0}});
+        if (i % 4 == 3) ecs_add(ecs, e, Frozen);
+    }
+
+    ecs_run(ecs, system);
+    test_check(term_rows == 75 && term_missing == 50);
+
+    ecs_delete(ecs);
+}
+
+int main(void) {
+    test_run(test_map);
+    test_run(test_component_ids);
+    test_run(test_spawn_n);
+    test_run(test_set_many);
+    test_run(test_run_parallel);
+    test_run(test_run_all);
+    test_run(test_query_cache);
+    test_run(test_ids);
+    test_run(test_records);
+    test_run(test_chunks);
+    test_run(test_flush);
+    test_run(test_reserved);
+    test_run(test_cmd_parallel);
+    test_run(test_ticks);
+    test_run(test_save_load);
+    test_run(test_stats);
+    test_run(test_identity);
+    test_run(test_allocators);
+    test_run(test_compact);
+    test_run(test_hierarchy);
+    test_run(test_tags);
+    test_run(test_aligned);
+    test_run(test_query_terms);
+    return test_failures != 0;
+}
@@ -0,0 +1,317 @@
+#define ECS_IMPL
+#include "../sparse_set.h"
+#include "test.h"
+
+enum { POS, VEL, HP, COMPONENT_COUNT };
+
+static ecs_t *world(void) {
+    return ecs_create(COMPONENT_COUNT, sizeof (int), sizeof (int), sizeof (int));
+}
+
+// Every entity in the group has all of its components, sits at the same dense position in each owned pool, and every
+// entity with all of them is in the group
+static void check_group(ecs_t *ecs, int group, int a, int b) {
+    size_t len = ecs_group_count(ecs, group);
+    ecs_id_t *entities = ecs_group_entities(ecs, group);
+    int *x = ecs_group_column(ecs, group, a), *y = ecs_group_column(ecs, group, b);
+
+    for (size_t i = 0; i < len; i++) {
+        test_check(ecs->pools[b].dense[i] == entities[i]);
+        test_check(ecs_get(ecs, entities[i], a) == &x[i] && ecs_get(ecs, entities[i], b) == &y[i]);
+    }
+
+    size_t both = 0;
+    for (ecs_view_t view = ecs_query(ecs, 2, a, b); ecs_valid(&view); ecs_next(&view))
+        both++;
+    test_check(both == len);
+}
+
+static void test_ids(void) {
+    ecs_t *ecs = world();
+
+    ecs_id_t a = ecs_spawn(ecs), b = ecs_spawn(ecs);
+    ecs_set(ecs, a, POS, &(int){1});
+    ecs_despawn(ecs, a);
+    ecs_despawn(ecs, a);
+    test_check(!ecs_get(ecs, a, POS));
+
+    // One free slot, even though the id was despawned twice
+    ecs_id_t c = ecs_spawn(ecs), d = ecs_spawn(ecs);
+    test_check(_ecs_lo32(c) == _ecs_lo32(a) && _ecs_hi32(c) == _ecs_hi32(a) + 1);
+    test_check(_ecs_lo32(d) == 2 && b != c);
+    test_check(!ecs_get(ecs, c, POS));
+
+    // A batch frees every index, the last one first
+    ecs_despawn_n(ecs, (ecs_id_t[]){b, c, d}, 3);
+    test_check(_ecs_lo32(ecs_spawn(ecs)) == _ecs_lo32(d));
+    test_check(_ecs_lo32(ecs_spawn(ecs)) == _ecs_lo32(c));
+    test_check(_ecs_lo32(ecs_spawn(ecs)) == _ecs_lo32(b));
+    test_check(_ecs_lo32(ecs_spawn(ecs)) == 3);
+
+    ecs_delete(ecs);
+}
+
+static void test_group(void) {
+    ecs_t *ecs = world();
+    ecs_id_t ids[1000];
+
+    for (int i = 0; i < 1000; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], POS, &i);
+        if (i % 3) ecs_set(ecs, ids[i], VEL, &i);
+        ecs_set(ecs, ids[i], HP, &i);
+    }
+
+    // Refused before any pool is marked as owned
+    test_check(ecs_group(ecs, 0) == -1 && ecs_group(ecs, 17) == -1 && ecs_group(ecs, 2, POS, COMPONENT_COUNT) == -1);
+    test_check(ecs_group(ecs, 2, VEL, VEL) == -1 && ecs_group(ecs, 2, HP, -1) == -1);
+    int group = ecs_group(ecs, 2, POS, VEL);
+    test_check(group == 0 && ecs_group(ecs, 2, VEL, HP) == -1 && !ecs->pools[HP].group);
+    test_check(ecs_group_count(ecs, group) == 666);
+    check_group(ecs, group, POS, VEL);
+
+    for (int i = 0; i < 1000; i += 2)
+        ecs_rem(ecs, ids[i], i % 4 ? POS : VEL);
+    for (int i = 0; i < 1000; i += 3)
+        ecs_set(ecs, ids[i], VEL, &i);
+    check_group(ecs, group, POS, VEL);
+
+    // A large batch sweeps the pools, a small one removes its entities one at a time
+    ecs_id_t batch[500];
+    size_t n = 0;
+    for (int i = 1; i < 1000; i += 2)
+        batch[n++] = ids[i];
+    ecs_despawn_n(ecs, batch, n);
+    check_group(ecs, group, POS, VEL);
+    ecs_despawn_n(ecs, (ecs_id_t[]){ids[0], ids[6]}, 2);
+    check_group(ecs, group, POS, VEL);
+
+    for (int i = 0; i < 1000; i++) {
+        int *hp = ecs_get(ecs, ids[i], HP);
+        test_check((i % 2 || i == 0 || i == 6) ? !hp : hp && *hp == i);
+    }
+
+    ecs_delete(ecs);
+}
+
+static void test_pages(void) {
+    ecs_t *ecs = world();
+    ecs_id_t ids[20000];
+
+    for (int i = 0; i < 20000; i++)
+        ids[i] = ecs_spawn(ecs);
+
+    // Only the pages of the entities holding the component are allocated, and growing the table doesn't move them
+    ecs_set(ecs, ids[5], POS, &(int){5});
+    _ecs_pool_t *pos = &ecs->pools[POS];
+    void *first = pos->sparse[0];
+    ecs_set(ecs, ids[19999], POS, &(int){19999});
+    test_check(_ecs_arr_len(pos->sparse) == 19999 / _ecs_page_size + 1);
+    test_check(pos->sparse[0] == first && !pos->sparse[1] && pos->sparse[19999 / _ecs_page_size]);
+    test_check(!ecs->pools[VEL].sparse);
+
+    test_check(*(int *)ecs_get(ecs, ids[19999], POS) == 19999 && *(int *)ecs_get(ecs, ids[5], POS) == 5);
+    test_check(!ecs_get(ecs, ids[6], POS) && !ecs_get(ecs, ids[_ecs_page_size], POS));
+    test_check(!ecs_get(ecs, ids[19999], VEL));
+
+    ecs_rem(ecs, ids[19999], POS);
+    test_check(!ecs_get(ecs, ids[19999], POS) && *(int *)ecs_get(ecs, ids[5], POS) == 5);
+
+    ecs_delete(ecs);
+}
+
+static size_t count_since(ecs_t *ecs, int filter, uint32_t since, int component) {
+    size_t n = 0;
+    for (ecs_view_t view = ecs_query_since(ecs, filter, since, 1, component); ecs_valid(&view); ecs_next(&view))
+        n++;
+    return n;
+}
+
+static void test_ticks(void) {
+    ecs_t *ecs = world();
+    ecs_id_t ids[10];
+
+    test_check(ecs_tick(ecs) == 1);
+    for (int i = 0; i < 10; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], POS, &i);
+    }
+
+    test_check(ecs_advance(ecs) == 2 && ecs_tick(ecs) == 2);
+    for (int i = 0; i < 3; i++)
+        ecs_set(ecs, ids[i], POS, &i);
+    ecs_set(ecs, ids[8], VEL, &(int){8});
+    ecs_set(ecs, ids[9], VEL, &(int){9});
+
+    test_check(count_since(ecs, ECS_CHANGED, 0, POS) == 10);
+    test_check(count_since(ecs, ECS_CHANGED, 1, POS) == 3);
+    test_check(count_since(ecs, ECS_ADDED, 1, POS) == 0);
+    test_check(count_since(ecs, ECS_ADDED, 1, VEL) == 2);
+
+    // An entity passes if any of the components is newer
+    size_t n = 0;
+    for (ecs_view_t view = ecs_query_since(ecs, ECS_ADDED, 1, 2, POS, VEL); ecs_valid(&view); ecs_next(&view))
+        n++;
+    test_check(n == 2);
+
+    // ecs_column_mut stamps the row, ecs_column doesn't
+    ecs_advance(ecs);
+    for (ecs_view_t view = ecs_query(ecs, 1, POS); ecs_valid(&view); ecs_next(&view)) {
+        int *value = *(int *)ecs_column(&view, POS) % 2 ? ecs_column(&view, POS) : ecs_column_mut(&view, POS);
+        (*value)++;
+    }
+    test_check(count_since(ecs, ECS_CHANGED, 2, POS) == 5);
+    test_check(*(int *)ecs_get(ecs, ids[4], POS) == 5);
+
+    ecs_delete(ecs);
+}
+
+static void test_save_load(void) {
+    ecs_t *ecs = world();
+    ecs_id_t ids[100];
+
+    for (int i = 0; i < 100; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], i % 2 ? POS : VEL, &i);
+    }
+    ecs_despawn(ecs, ids[10]);
+    test_check(!ecs_save(ecs, "test_sparse_set.ecs"));
+
+    ecs_t *loaded = ecs_load("test_sparse_set.ecs");
+    test_check(loaded);
+    if (loaded) {
+        for (int i = 0; i < 100; i++) {
+            int *value = ecs_get(loaded, ids[i], i % 2 ? POS : VEL);
+            test_check(i == 10 ? !value : value && *value == i);
+        }
+        test_check(_ecs_lo32(ecs_spawn(loaded)) == 10);
+        ecs_delete(loaded);
+    }
+
+    test_check(!ecs_load("test_missing.ecs"));
+    remove("test_sparse_set.ecs");
+    ecs_delete(ecs);
+}
+
+// Wraps malloc and keeps count of what the world still holds, which has to be nothing once it is deleted
+typedef struct {
+    long blocks, bytes;
+} counter_t;
+
+static void *counting_alloc(void *ctx, size_t size, size_t align) {
+    counter_t *counter = ctx;
+    void *ptr = _ecs_libc.alloc(NULL, size, align);
+    if (ptr) counter->blocks++, counter->bytes += (long)size;
+    return ptr;
+}
+
+static void *counting_realloc(void *ctx, void *ptr, size_t old_size, size_t size) {
+    counter_t *counter = ctx;
+    void *next = _ecs_libc.realloc(NULL, ptr, old_size, size);
+    if (next) counter->blocks += !ptr, counter->bytes += (long)size - (long)old_size;
+    return next;
+}
+
+static void counting_free(void *ctx, void *ptr, size_t size) {
+    counter_t *counter = ctx;
+    if (ptr) counter->blocks--, counter->bytes -= (long)size;
+    _ecs_libc.free(NULL, ptr, size);
+}
+
+static void test_allocators(void) {
+    counter_t counter = {0};
+    ecs_allocator_t counting = {counting_alloc, counting_realloc, counting_free, NULL, &counter};
+    ecs_allocator_t arena = ecs_arena(4096);
+
+    for (int pass = 0; pass < 2; pass++) {
+        ecs_allocator_t const *allocator = pass ? &arena : &counting;
+        ecs_t *ecs = ecs_create_with(allocator, COMPONENT_COUNT, sizeof (int), sizeof (int), sizeof (int));
+        ecs_id_t ids[10000];
+
+        // Spread over a few sparse pages
+        for (int i = 0; i < 10000; i++) {
+            ids[i] = ecs_spawn(ecs);
+            ecs_set(ecs, ids[i], i % 2 ? POS : VEL, &i);
+            if (i % 3 == 0) ecs_set(ecs, ids[i], HP, &i);
+        }
+        for (int i = 0; i < 10000; i += 4)
+            ecs_rem(ecs, ids[i], VEL);
+
+        for (int i = 0; i < 10000; i++) {
+            int *value = ecs_get(ecs, ids[i], i % 2 ? POS : VEL);
+            test_check(i % 4 == 0 ? !value : value && *value == i);
+        }
+
+        ecs_delete(ecs);
+    }
+
+    test_check(counter.blocks == 0 && counter.bytes == 0);
+
+    // What ecs_arena returns when it runs out of memory is turned down instead of called
+    ecs_allocator_t failed = {0};
+    test_check(!ecs_create_with(&failed, 0));
+}
+
+static int by_value(ecs_id_t a, void const *a_data, ecs_id_t b, void const *b_data, void *ctx) {
+    (void)a, (void)b, (void)ctx;
+    return *(int const *)a_data - *(int const *)b_data;
+}
+
+static void test_sort(void) {
+    ecs_t *ecs = world();
+    ecs_id_t ids[300];
+
+    for (int i = 0; i < 300; i++) {
+        ids[i] = ecs_spawn(ecs);
+        ecs_set(ecs, ids[i], POS, &(int){(i * 7919) % 300});
+        if (i % 4) ecs_set(ecs, ids[i], VEL, &i);
+    }
+    ecs_advance(ecs);
+    for (int i = 0; i < 10; i++) {
+        int value = *(int *)ecs_get(ecs, ids[i], POS);
+        ecs_set(ecs, ids[i], POS, &value);
+    }
+
+    // POS by value, then VEL following POS: the shared entities first in POS's order, the rest after them
+    test_check(!ecs_sort(ecs, POS, by_value, NULL));
+    test_check(!ecs_sort_as(ecs, VEL, POS));
+
+    _ecs_pool_t *pos = &ecs->pools[POS], *vel = &ecs->pools[VEL];
+    size_t k = 0;
+    for (size_t i = 0; i < _ecs_arr_len(pos->dense); i++) {
+        test_check(*(int *)ecs_get(ecs, pos->dense[i], POS) == (int)i);
+        if (_ecs_pool_has(vel, pos->dense[i]))
+            test_check(vel->dense[k++] == pos->dense[i]);
+    }
+    test_check(k == _ecs_arr_len(vel->dense));
+
+    // The change ticks moved along with their rows
+    size_t changed = 0;
+    for (ecs_view_t view = ecs_query_since(ecs, ECS_CHANGED, 1, 1, POS); ecs_valid(&view); ecs_next(&view))
+        changed += _ecs_lo32(view.entity) < 10;
+    test_check(changed == 10 && count_since(ecs, ECS_CHANGED, 1, POS) == 10);
+
+    // Without a comparator the order goes back to the entity indices
+    test_check(!ecs_sort(ecs, POS, NULL, NULL));
+    for (int i = 0; i < 300; i++) {
+        test_check(pos->dense[i] == ids[i]);
+        test_check(*(int *)ecs_get(ecs, ids[i], POS) == (i * 7919) % 300);
+        test_check(!(i % 4) || *(int *)ecs_get(ecs, ids[i], VEL) == i);
+    }
+
+    ecs_group(ecs, 2, POS, HP);
+    test_check(ecs_sort(ecs, POS, NULL, NULL) == -1 && ecs_sort_as(ecs, POS, VEL) == -1);
+
+    ecs_delete(ecs);
+}
+
+int main(void) {
+    test_run(test_ids);
+    test_run(test_group);
+    test_run(test_pages);
+    test_run(test_ticks);
+    test_run(test_sort);
+    test_run(test_save_load);
+    test_run(test_allocators);
+    return test_failures != 0;
+}